@@ -0,0 +1,163 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Paints a fixed pattern into an ivi surface and keeps it on screen, so the
+// benchmark has known content to capture: four quadrants, red, green, blue
+// and white, from the top left in reading order.
+
+#include <CLI/CLI11.hpp>
+#include <cstring>
+#include <ivi-application-client-protocol.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+namespace {
+struct paint_client_t {
+  wl_compositor *compositor = nullptr;
+  wl_shm *shm = nullptr;
+  ivi_application *application = nullptr;
+};
+
+void registry_handler(void *data, wl_registry *registry, uint32_t const name,
+                      char const *interface, uint32_t) {
+  auto client = reinterpret_cast<paint_client_t *>(data);
+  if (strcmp(interface, wl_compositor_interface.name) == 0) {
+    client->compositor = reinterpret_cast<wl_compositor *>(
+        wl_registry_bind(registry, name, &wl_compositor_interface, 1));
+  } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+    client->shm = reinterpret_cast<wl_shm *>(
+        wl_registry_bind(registry, name, &wl_shm_interface, 1));
+  } else if (strcmp(interface, ivi_application_interface.name) == 0) {
+    client->application = reinterpret_cast<ivi_application *>(
+        wl_registry_bind(registry, name, &ivi_application_interface, 1));
+  }
+}
+void registry_remover(void *, wl_registry *, uint32_t) {}
+
+wl_registry_listener const registry_listener = {
+    registry_handler,
+    registry_remover,
+};
+
+void surface_configure(void *, ivi_surface *, int32_t, int32_t) {}
+
+ivi_surface_listener const surface_listener = {
+    surface_configure,
+};
+
+void paint_quadrants(uint32_t *pixels, int const width, int const height) {
+  uint32_t const colours[] = {0xffff0000, 0xff00ff00, 0xff0000ff, 0xffffffff};
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int const quadrant = (y >= height / 2) * 2 + (x >= width / 2);
+      pixels[y * width + x] = colours[quadrant];
+    }
+  }
+}
+
+wl_buffer *create_buffer(wl_shm *shm, int const width, int const height) {
+  int const stride = width * 4;
+  auto const size = (std::size_t)stride * height;
+  int const fd = memfd_create("qadx-paint-client", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+    spdlog::error("unable to allocate the buffer: {}", strerror(errno));
+    return nullptr;
+  }
+  auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    spdlog::error("unable to map the buffer: {}", strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+  paint_quadrants(reinterpret_cast<uint32_t *>(memory), width, height);
+  munmap(memory, size);
+
+  auto pool = wl_shm_create_pool(shm, fd, (int32_t)size);
+  auto buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride,
+                                          WL_SHM_FORMAT_XRGB8888);
+  wl_shm_pool_destroy(pool);
+  close(fd);
+  return buffer;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  CLI::App cli_parser{"paints four coloured quadrants into an ivi surface",
+                      "qadx-paint-client"};
+  uint32_t surface_id = 10;
+  std::string size = "1280x720";
+  cli_parser.add_option("--surface-id", surface_id,
+                        "ivi id of the surface; defaults to 10");
+  cli_parser.add_option("--size", size,
+                        "WIDTHxHEIGHT of the surface; defaults to 1280x720");
+  CLI11_PARSE(cli_parser, argc, argv)
+
+  int width = 0;
+  int height = 0;
+  if (sscanf(size.c_str(), "%dx%d", &width, &height) != 2 || width < 2 ||
+      height < 2) {
+    spdlog::error("--size must be WIDTHxHEIGHT");
+    return EXIT_FAILURE;
+  }
+
+  auto display = wl_display_connect(nullptr);
+  if (!display) {
+    spdlog::error("failed to connect to WL display: {}", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  paint_client_t client{};
+  auto registry = wl_display_get_registry(display);
+  wl_registry_add_listener(registry, &registry_listener, &client);
+  wl_display_roundtrip(display);
+  if (!client.compositor || !client.shm || !client.application) {
+    spdlog::error("compositor lacks wl_shm or ivi_application, is it running "
+                  "ivi-shell?");
+    return EXIT_FAILURE;
+  }
+
+  auto buffer = create_buffer(client.shm, width, height);
+  if (!buffer)
+    return EXIT_FAILURE;
+  auto surface = wl_compositor_create_surface(client.compositor);
+  auto shell_surface =
+      ivi_application_surface_create(client.application, surface_id, surface);
+  ivi_surface_add_listener(shell_surface, &surface_listener, nullptr);
+  wl_surface_attach(surface, buffer, 0, 0);
+  wl_surface_damage(surface, 0, 0, width, height);
+  wl_surface_commit(surface);
+  spdlog::info("surface {} painted at {}x{}", surface_id, width, height);
+
+  // the surface stays up until the compositor goes away or we are killed
+  while (wl_display_dispatch(display) != -1) {
+  }
+
+  ivi_surface_destroy(shell_surface);
+  wl_surface_destroy(surface);
+  wl_buffer_destroy(buffer);
+  wl_display_disconnect(display);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Load generator for a running qadx: a number of keep-alive connections
+// request screenshots back to back and the latency of every request is
+// kept, to report percentiles and throughput once they are done. With
+// --check-quadrants every BMP reply is also checked against the pattern
+// painted by qadx-paint-client.
+
+#include <CLI/CLI11.hpp>
+#include <algorithm>
+#include <atomic>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <chrono>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+struct bench_args_t {
+  std::string host = "127.0.0.1";
+  std::string port = "3000";
+  std::string target = "/screen/0";
+  int connections = 1;
+  int requests = 200;
+  int warmup = 10;
+  bool check_quadrants = false;
+};
+
+struct worker_result_t {
+  std::vector<double> latencies_ms{};
+  std::size_t bytes = 0;
+  int errors = 0;
+  int mismatches = 0;
+};
+
+uint32_t read_le32(std::string const &data, std::size_t const offset) {
+  uint32_t value = 0;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+// the pixel at (x, y), counted from the top left, as 0xRRGGBB
+uint32_t bmp_pixel(std::string const &bmp, int const x, int const y) {
+  auto const offset = read_le32(bmp, 10);
+  auto const width = (int32_t)read_le32(bmp, 18);
+  auto const height = (int32_t)read_le32(bmp, 22);
+  auto const bpp = (int)(uint16_t)read_le32(bmp, 28);
+  auto const stride = (std::size_t)((width * bpp / 8 + 3) & ~3);
+  // positive heights are stored bottom-up
+  auto const row = height > 0 ? height - 1 - y : y;
+  auto const at = offset + row * stride + (std::size_t)x * (bpp / 8);
+  if (at + 3 > bmp.size())
+    return 0;
+  auto const pixel = reinterpret_cast<uint8_t const *>(bmp.data() + at);
+  return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+}
+
+bool matches_quadrants(std::string const &bmp) {
+  if (bmp.size() < 54 || bmp.compare(0, 2, "BM") != 0)
+    return false;
+  auto const width = (int)read_le32(bmp, 18);
+  auto const height = std::abs((int32_t)read_le32(bmp, 22));
+  // red, green, blue and white
+  uint32_t const expected[] = {0xff0000, 0x00ff00, 0x0000ff, 0xffffff};
+  for (int quadrant = 0; quadrant < 4; ++quadrant) {
+    int const x = width / 4 + (quadrant % 2) * width / 2;
+    int const y = height / 4 + (quadrant / 2) * height / 2;
+    if (bmp_pixel(bmp, x, y) != expected[quadrant])
+      return false;
+  }
+  return true;
+}
+
+void run_worker(bench_args_t const &args, std::atomic<int> &remaining,
+                worker_result_t &result) {
+  net::io_context io_context{};
+  tcp::resolver resolver{io_context};
+  beast::tcp_stream stream{io_context};
+  beast::flat_buffer buffer{};
+  bool connected = false;
+
+  http::request<http::empty_body> request{http::verb::get, args.target, 11};
+  request.set(http::field::host, args.host);
+  request.keep_alive(true);
+
+  while (remaining.fetch_sub(1) > 0) {
+    auto const start = clock_type::now();
+    try {
+      if (!connected) {
+        stream.connect(resolver.resolve(args.host, args.port));
+        connected = true;
+      }
+      http::write(stream, request);
+      http::response_parser<http::string_body> parser{};
+      parser.body_limit(256 * 1024 * 1024);
+      http::read(stream, buffer, parser);
+      auto const &response = parser.get();
+      std::chrono::duration<double, std::milli> const elapsed =
+          clock_type::now() - start;
+
+      if (response.result() != http::status::ok) {
+        ++result.errors;
+      } else {
+        result.latencies_ms.push_back(elapsed.count());
+        result.bytes += response.body().size();
+        if (args.check_quadrants && !matches_quadrants(response.body()))
+          ++result.mismatches;
+      }
+      if (!response.keep_alive()) {
+        stream.close();
+        connected = false;
+      }
+    } catch (std::exception const &e) {
+      spdlog::error("request failed: {}", e.what());
+      ++result.errors;
+      beast::error_code ec{};
+      stream.socket().close(ec);
+      connected = false;
+    }
+  }
+}
+
+double percentile(std::vector<double> const &sorted, double const rank) {
+  if (sorted.empty())
+    return 0.0;
+  auto const index = (std::size_t)(rank / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  CLI::App cli_parser{"measures screenshot latency and throughput of qadx",
+                      "qadx-bench"};
+  bench_args_t args{};
+  cli_parser.add_option("--host", args.host, "defaults to 127.0.0.1");
+  cli_parser.add_option("-p,--port", args.port, "defaults to 3000");
+  cli_parser.add_option("-t,--target", args.target,
+                        "URL to request; defaults to /screen/0");
+  cli_parser.add_option("-c,--connections", args.connections,
+                        "concurrent connections; defaults to 1");
+  cli_parser.add_option("-n,--requests", args.requests,
+                        "requests over all connections; defaults to 200");
+  cli_parser.add_option("--warmup", args.warmup,
+                        "requests sent, and ignored, first; defaults to 10");
+  cli_parser.add_flag("--check-quadrants", args.check_quadrants,
+                      "check replies against qadx-paint-client's pattern");
+  CLI11_PARSE(cli_parser, argc, argv)
+
+  if (args.connections < 1 || args.requests < 1) {
+    spdlog::error("--connections and --requests must be positive");
+    return EXIT_FAILURE;
+  }
+
+  if (args.warmup > 0) {
+    std::atomic<int> remaining{args.warmup};
+    worker_result_t ignored{};
+    run_worker(args, remaining, ignored);
+    if (ignored.latencies_ms.empty()) {
+      spdlog::error("qadx did not serve {}", args.target);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::atomic<int> remaining{args.requests};
+  std::vector<worker_result_t> results(args.connections);
+  std::vector<std::thread> workers{};
+  auto const start = clock_type::now();
+  for (auto &result : results) {
+    workers.emplace_back(
+        [&, result = &result] { run_worker(args, remaining, *result); });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  std::chrono::duration<double> const elapsed = clock_type::now() - start;
+
+  worker_result_t total{};
+  for (auto const &result : results) {
+    total.latencies_ms.insert(total.latencies_ms.end(),
+                              result.latencies_ms.begin(),
+                              result.latencies_ms.end());
+    total.bytes += result.bytes;
+    total.errors += result.errors;
+    total.mismatches += result.mismatches;
+  }
+  auto &latencies = total.latencies_ms;
+  std::sort(latencies.begin(), latencies.end());
+
+  fmt::print("{} connections, {} requests to {} in {:.2f}s\n",
+             args.connections, args.requests, args.target, elapsed.count());
+  fmt::print("  throughput: {:.1f} req/s, {:.1f} MiB/s\n",
+             latencies.size() / elapsed.count(),
+             total.bytes / elapsed.count() / (1024.0 * 1024.0));
+  fmt::print("  latency ms: p50 {:.2f}, p90 {:.2f}, p99 {:.2f}, max {:.2f}\n",
+             percentile(latencies, 50), percentile(latencies, 90),
+             percentile(latencies, 99), percentile(latencies, 100));
+  fmt::print("  errors: {}, content mismatches: {}\n", total.errors,
+             total.mismatches);
+  return total.errors == 0 && total.mismatches == 0 ? EXIT_SUCCESS
+                                                    : EXIT_FAILURE;
+}
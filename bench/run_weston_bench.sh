@@ -0,0 +1,98 @@
+#!/usr/bin/env bash
+# Benchmarks the ILM capture path end to end without hardware: a headless
+# Weston running ivi-shell and wayland-ivi-extension's ivi-controller shows
+# qadx-paint-client's quadrants, qadx captures them through `-s ilm` and
+# qadx-bench measures screenshot latency at growing concurrency.
+#
+# usage: run_weston_bench.sh <build dir> [connections ...]
+# environment: BENCH_SIZE (1280x720), BENCH_REQUESTS (200), BENCH_PORT
+# (3999), BENCH_SCREEN (0), IVI_CONTROLLER (path to ivi-controller.so)
+
+set -eu
+
+build_dir="$(realpath "${1:?usage: $0 <build dir> [connections ...]}")"
+shift
+connections=(1 4 16)
+[ $# -gt 0 ] && connections=("$@")
+
+size="${BENCH_SIZE:-1280x720}"
+width="${size%x*}"
+height="${size#*x}"
+requests="${BENCH_REQUESTS:-200}"
+port="${BENCH_PORT:-3999}"
+screen="${BENCH_SCREEN:-0}"
+surface=10
+layer=1000
+
+if [ -z "${IVI_CONTROLLER:-}" ]; then
+  IVI_CONTROLLER="$(find /usr/local/lib /usr/lib -name ivi-controller.so \
+    2>/dev/null | head -n 1)"
+fi
+if [ -z "$IVI_CONTROLLER" ]; then
+  echo "ivi-controller.so not found, build wayland-ivi-extension" >&2
+  exit 1
+fi
+
+work_dir="$(mktemp -d)"
+pids=()
+cleanup() {
+  for pid in "${pids[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  wait 2>/dev/null || true
+  rm -rf "$work_dir"
+}
+trap cleanup EXIT
+
+export XDG_RUNTIME_DIR="$work_dir"
+export WAYLAND_DISPLAY=qadx-bench
+chmod 700 "$work_dir"
+
+cat > "$work_dir/weston.ini" <<INI
+[core]
+shell=ivi-shell.so
+idle-time=0
+
+[ivi-shell]
+ivi-module=$IVI_CONTROLLER
+INI
+
+# waits up to five seconds for a command to succeed
+wait_for() {
+  for _ in $(seq 50); do
+    "$@" >/dev/null 2>&1 && return 0
+    sleep 0.1
+  done
+  echo "timed out waiting for: $*" >&2
+  return 1
+}
+
+# the headless backend only renders anything with pixman or GL
+weston --backend=headless-backend.so --use-pixman \
+  --config="$work_dir/weston.ini" --socket="$WAYLAND_DISPLAY" \
+  --width="$width" --height="$height" \
+  --log="$work_dir/weston.log" &
+pids+=($!)
+wait_for test -S "$work_dir/$WAYLAND_DISPLAY"
+
+"$build_dir/qadx-paint-client" --surface-id "$surface" --size "$size" &
+pids+=($!)
+wait_for LayerManagerControl get surface "$surface"
+
+LayerManagerControl create layer "$layer" "$width" "$height"
+region=(0 0 "$width" "$height")
+LayerManagerControl set surface "$surface" source region "${region[@]}"
+LayerManagerControl set surface "$surface" destination region "${region[@]}"
+LayerManagerControl set surface "$surface" visibility 1
+LayerManagerControl set layer "$layer" render order "$surface"
+LayerManagerControl set layer "$layer" visibility 1
+LayerManagerControl set screen "$screen" render order "$layer"
+
+"$build_dir/qadx" -p "$port" -s ilm -i record &
+pids+=($!)
+wait_for curl -sf "http://127.0.0.1:$port/ready"
+
+for count in "${connections[@]}"; do
+  "$build_dir/qadx-bench" -p "$port" -t "/screen/$screen" -c "$count" \
+    -n "$requests" --check-quadrants
+done
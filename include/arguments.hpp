@@ -26,23 +26,66 @@
 #pragma once
 
 #include "enumerations.hpp"
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace qadx {
+// frames served by the synthetic screen backend
+struct synthetic_args_t {
+  // "pattern", a PNG file, a directory of PNG files played in name order,
+  // or a file of raw frames in `format`
+  std::string source = "pattern";
+  int width = 1280;
+  int height = 720;
+  uint32_t format = 0; // DRM fourcc the frames are stored in
+  int fps = 30;
+  int screens = 1;
+};
+
 struct cli_args_t {
   int port = 3465;
   int kms_format_rgb = 0;
+  int vnc_port = 0;
+  int vnc_screen = -1;
+  int vnc_fps = 10;
+  int vnc_pointer_event = 2;
+  int vnc_keyboard_event = 1;
+  int capture_fps = 0;
+  int capture_ring_size = 8;
+  int huge_pages = 0;
+  std::string capture_policy{};
+  std::string recording_dir{};
+  std::string archive_dir{};
+  std::string input_record{};
   std::string input_type = "uinput";
   std::string screen_backend = "kms";
+  std::string synthetic_source = "pattern";
+  std::string synthetic_size = "1280x720";
+  std::string synthetic_format = "XR24";
+  int synthetic_fps = 30;
+  int synthetic_screens = 1;
 };
 
 struct runtime_args_t {
   int port = 0;
   int kms_format_rgb = 0;
+  int vnc_port = 0; // 0 disables the VNC server
+  int vnc_screen = -1;
+  int vnc_fps = 10;
+  int vnc_pointer_event = 2;
+  int vnc_keyboard_event = 1;
+  int capture_fps = 10;
+  int capture_ring_size = 8;
+  int huge_pages = 0; // back large image buffers with huge pages
+  std::string recording_dir{}; // empty records to the temp directory
+  std::string archive_dir{};   // empty disables the frame archive
+  std::string input_record{};  // empty records input events to memory
   screen_type_e screen_backend = screen_type_e::none;
+  capture_policy_e capture_policy = capture_policy_e::on_demand;
   input_type_e input_backend = input_type_e::none;
   std::vector<std::string> kms_backend_cards;
+  synthetic_args_t synthetic{};
 };
 
 } // namespace qadx
\ No newline at end of file
@@ -26,6 +26,8 @@
 #pragma once
 
 #include "backends/input/evdev.hpp"
+#include "backends/input/gesture.hpp"
+#include "backends/input/record.hpp"
 #include "backends/input/uinput.hpp"
 #include <variant>
 
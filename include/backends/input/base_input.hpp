@@ -27,15 +27,18 @@
 #include <vector>
 
 namespace qadx {
+namespace utils {
+class event_frame_t;
+}
+
 struct base_input_t {
   base_input_t() = default;
   virtual ~base_input_t() = default;
   virtual bool move(int x_axis, int y_axis, int event) = 0;
   virtual bool button(int value, int event) = 0;
-  virtual bool touch(int x, int y, int duration, int event) = 0;
-  virtual bool swipe(int x1, int y1, int x2, int y2, int velocity,
-                     int event) = 0;
   virtual bool key(int key, int event) = 0;
-  virtual bool text(std::vector<int> const &key_codes, int event) = 0;
+  // writes one frame to the device, timed gestures are sent a frame at a
+  // time by play_gesture
+  virtual bool send_frame(utils::event_frame_t &frame, int event) = 0;
 };
 } // namespace qadx
\ No newline at end of file
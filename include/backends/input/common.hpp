@@ -25,6 +25,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <linux/input.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <vector>
@@ -34,19 +37,30 @@
 
 namespace qadx {
 namespace utils {
-bool send_syn_event(int fd);
-bool send_button_event(int value, int event);
-bool send_pressure_event(int value, int event);
-bool send_major_event(int value, int event);
-bool send_position_event_abs(int x, int y, int event);
-bool send_position_event_mt(int x, int y, int event);
-bool send_tracking_event(int value, int event);
-bool send_swipe_header(int major_value, int pressure, int event);
-bool send_swipe_footer(int event);
-bool send_touch(int x, int y, int duration, int event);
-bool send_swipe(int x, int y, int x_2, int y_2, int v, int event);
-bool send_key_event(int key, int fd);
-bool send_text_event(std::vector<int> const &key_codes, int fd);
+// The events of one EV_SYN-terminated frame, written to the device with a
+// single write() so that readers never see half of it. The largest, the
+// first contact of a swipe, is eight events with its SYN_REPORT.
+class event_frame_t {
+  input_event m_events[16]{};
+  std::size_t m_count = 0;
+  bool m_overflow = false; // the frame is dropped rather than cut short
+
+public:
+  event_frame_t &add(uint16_t type, uint16_t code, int value);
+  // appends SYN_REPORT, writes the frame and starts a new one
+  bool submit(int fd);
+};
+
+void add_button_event(event_frame_t &frame, int value);
+void add_pressure_event(event_frame_t &frame, int value);
+void add_major_event(event_frame_t &frame, int value);
+void add_position_event_abs(event_frame_t &frame, int x, int y);
+void add_position_event_mt(event_frame_t &frame, int x, int y);
+void add_tracking_event(event_frame_t &frame, int value);
+
+bool send_move(int x, int y, int fd);
+bool send_button(int value, int fd);
+bool send_key(int key, int fd);
 } // namespace utils
 
 class auto_close_fd_t {
@@ -47,7 +47,6 @@
 namespace qadx {
 
 using namespace qadx::utils;
-using qad_screen_buffer_t = std::vector<unsigned char>;
 
 class ev_dev_backend_t final : public base_input_t {
   ev_dev_backend_t() = default;
@@ -62,43 +61,24 @@ public:
 
   bool move(int const x_axis, int const y_axis, int const event) final {
     auto_close_fd_t file_descriptor(create_file_descriptor(event));
-    return send_position_event_mt(x_axis, y_axis, file_descriptor) &&
-           send_syn_event(file_descriptor);
+    return send_move(x_axis, y_axis, file_descriptor);
   }
 
   bool button(int const value, int const event) final {
     auto_close_fd_t file_descriptor(create_file_descriptor(event));
-    int tracking_event = 100;
-    if (value == 0)
-      tracking_event = -1;
-
-    return send_tracking_event(tracking_event, file_descriptor) &&
-           send_button_event(value, file_descriptor) &&
-           send_syn_event(file_descriptor);
-  }
-
-  bool touch(int const x, int const y, int const duration,
-             int const event) final {
-    auto_close_fd_t file_descriptor(create_file_descriptor(event));
-    return send_touch(x, y, duration, event);
-  }
-
-  bool swipe(int const x1, int const y1, int const x2, int const y2,
-             int const velocity, int const event) final {
-    auto_close_fd_t file_descriptor(create_file_descriptor(event));
-    return send_swipe(x1, y1, x2, y2, velocity, file_descriptor);
+    return send_button(value, file_descriptor);
   }
 
   bool key(int const key, int const event) final {
     auto_close_fd_t fd(create_file_descriptor(event));
-    QAD_CHECK_BOOL_ERR(send_key_event(key, fd))
-    return send_syn_event(fd);
+    return send_key(key, fd);
   }
 
-  bool text(std::vector<int> const &key_codes, int const event) final {
+  // the device is opened for each frame, nothing needs it held open
+  // between the frames of a gesture
+  bool send_frame(event_frame_t &frame, int const event) final {
     auto_close_fd_t fd(create_file_descriptor(event));
-    QAD_CHECK_BOOL_ERR(send_text_event(key_codes, fd))
-    return true;
+    return frame.submit(fd);
   }
 
 private:
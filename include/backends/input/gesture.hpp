@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "backends/input/base_input.hpp"
+#include "backends/input/common.hpp"
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace qadx {
+namespace net = boost::asio;
+
+// A gesture is the frames of a touch, swipe or typed text together with the
+// time to wait before each of them, so that it can be sent from timers
+// instead of sleeping in the thread that handles the request.
+struct gesture_step_t {
+  std::chrono::milliseconds delay{};
+  utils::event_frame_t frame{};
+};
+// fills in the next step of the gesture, false once there are none left;
+// steps are made as they are played so long gestures take no memory
+using gesture_t = std::function<bool(gesture_step_t &step)>;
+using gesture_callback_t = std::function<void(bool)>;
+
+gesture_t touch_gesture(int x, int y, int duration_s);
+gesture_t swipe_gesture(int x, int y, int x2, int y2, int steps);
+gesture_t text_gesture(std::vector<int> const &key_codes);
+
+// sends `gesture` to the `event` device of `input` on `io_context` timers,
+// `callback` is called with whether every frame was written, once the last
+// one is or as soon as one isn't
+void play_gesture(net::io_context &io_context, base_input_t *input, int event,
+                  gesture_t gesture, gesture_callback_t callback);
+} // namespace qadx
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "backends/input/base_input.hpp"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace qadx {
+// one recorded event, as written to the sink or served by /input/events
+struct input_record_t {
+  int64_t timestamp_us; // CLOCK_MONOTONIC time the event was written at
+  int32_t device;       // the `event` the request was sent to
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+  int32_t reserved;
+};
+static_assert(sizeof(input_record_t) == 24);
+
+// an input backend that records the events it's sent instead of injecting
+// them. Each device writes to a pipe, exactly as it'd write to uinput, and
+// a thread moves what arrives to a file, a FIFO or an in-memory ring.
+class record_backend_t final : public base_input_t {
+  friend std::unique_ptr<record_backend_t>
+  create_instance(std::string const &sink);
+  record_backend_t() = default;
+
+public:
+  ~record_backend_t() override;
+  static record_backend_t *create_global_instance(std::string const &sink);
+
+  bool move(int x_axis, int y_axis, int event) final;
+  bool button(int value, int event) final;
+  bool key(int key, int event) final;
+  bool send_frame(utils::event_frame_t &frame, int event) final;
+
+  // false when the events go to a file or a FIFO instead of the ring
+  bool records_to_ring() const { return m_sink < 0; }
+  // every event sent so far that's still in the ring, oldest first
+  std::vector<input_record_t> recorded_events(uint64_t &dropped);
+  void clear();
+
+private:
+  struct device_t {
+    int read_fd = -1;
+    int write_fd = -1;
+    std::vector<char> pending{};
+  };
+
+  int device_fd(int event);
+  void drain();
+  void collect();
+  void store(input_record_t const *records, std::size_t count);
+
+  std::mutex m_mutex{};
+  std::map<int, device_t> m_devices{};
+  std::deque<input_record_t> m_ring{};
+  uint64_t m_dropped = 0;
+  int m_sink = -1;
+  int m_wakeFd = -1;
+  std::atomic_bool m_running = true;
+  std::thread m_drainThread{};
+};
+} // namespace qadx
@@ -66,11 +66,11 @@ public:
     int &fd = get_uinput_file_descriptor(event);
     if (fd < 0)
       return false;
-    if (!send_position_event_mt(x, y, fd)) {
+    if (!send_move(x, y, fd)) {
       close(fd);
       return false;
     }
-    return send_syn_event(fd);
+    return true;
   }
 
   bool button(int const value, int const event) final {
@@ -78,51 +78,35 @@ public:
     if (fd < 0)
       return false;
 
-    int const tracking_event = value == 0 ? -1 : 100;
-    if (!(send_tracking_event(tracking_event, event) &&
-          send_button_event(value, event))) {
+    if (!send_button(value, fd)) {
       close(fd);
       return false;
     }
-
-    return send_syn_event(event);
+    return true;
   }
 
-  bool touch(int const x, int const y, int const duration,
-             int const event) final {
+  bool key(int const key, int const event) final {
     if (int &fd = get_uinput_file_descriptor(event); fd > 0) {
-      bool const succeed = send_touch(x, y, duration, fd);
-      if (!succeed)
+      if (!send_key(key, fd)) {
         close(fd);
-      return succeed;
+        return false;
+      }
+      return true;
     }
     return false;
   }
 
-  bool swipe(int const x1, int const y1, int const x2, int const y2,
-             int const velocity, int const event) final {
-    if (int &fd = get_uinput_file_descriptor(event); fd > 0)
-      return send_swipe(x1, y1, x2, y2, velocity, fd);
-    return false;
-  }
-
-  bool key(int const key, int const event) final {
+  bool send_frame(event_frame_t &frame, int const event) final {
     if (int &fd = get_uinput_file_descriptor(event); fd > 0) {
-      if (!send_key_event(key, fd)) {
+      if (!frame.submit(fd)) {
         close(fd);
         return false;
       }
-      return send_syn_event(fd);
+      return true;
     }
     return false;
   }
 
-  bool text(std::vector<int> const &key_codes, int const event) final {
-    if (int &fd = get_uinput_file_descriptor(event); fd > 0)
-      return send_text_event(key_codes, fd);
-    return false;
-  }
-
 private:
   static int create_mouse() {
     int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
@@ -25,13 +25,78 @@
 
 #pragma once
 #include "image.hpp"
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 namespace qadx {
+using raw_frames_callback_t = std::function<void(std::vector<raw_frame_t>)>;
+
+// a screenshot as grabbed by grab_screenshot_async
+struct grabbed_screenshot_t {
+  bool captured = false;
+  uint64_t hash = 0; // hash_frame of what was grabbed
+  // the pixels, left empty by backends that encoded them straight away
+  raw_frame_t frame{};
+  // what encode_raw_frame makes of them, when the backend did so already
+  std::shared_ptr<image_data_t> image = nullptr;
+};
+using screenshot_grab_callback_t = std::function<void(grabbed_screenshot_t)>;
+
 struct base_screen_t {
   base_screen_t() = default;
   virtual ~base_screen_t() = default;
   virtual std::string list_screens() = 0;
   virtual bool grab_frame_buffer(image_data_t &screen_buffer, int screen) = 0;
+  virtual bool grab_raw_frame(raw_frame_t &frame, int screen) = 0;
+  // the screens that can be captured right now
+  virtual std::vector<int> screen_ids() = 0;
+  // whether grab_raw_frame may be called for several screens at once
+  virtual bool concurrent_grabs() const { return false; }
+  // grabs every screen in `screens` as close together in time as the
+  // backend can, a frame left empty couldn't be grabbed
+  virtual void grab_raw_frames(std::vector<int> const &screens,
+                               std::vector<raw_frame_t> &frames) {
+    frames.resize(screens.size());
+    for (std::size_t i = 0; i < screens.size(); ++i) {
+      if (!grab_raw_frame(frames[i], screens[i]))
+        frames[i].data.clear();
+    }
+  }
+  // grab_raw_frames without waiting for the frames: `callback` gets them,
+  // possibly on another thread. Backends that can't grab asynchronously
+  // grab on the calling thread
+  virtual void grab_raw_frames_async(std::vector<int> const &screens,
+                                     raw_frames_callback_t callback) {
+    std::vector<raw_frame_t> frames{};
+    grab_raw_frames(screens, frames);
+    callback(std::move(frames));
+  }
+  // grabs one screen for a screenshot, as grab_raw_frames_async would.
+  // Backends whose encoding is no more than a conversion of their own
+  // buffer write the image from it directly, with no raw frame in between
+  virtual void grab_screenshot_async(int screen,
+                                     screenshot_grab_callback_t callback) {
+    grab_raw_frames_async(
+        {screen}, [callback = std::move(callback)](
+                      std::vector<raw_frame_t> frames) {
+          grabbed_screenshot_t grabbed{};
+          grabbed.frame = std::move(frames[0]);
+          grabbed.captured = !grabbed.frame.data.empty();
+          if (grabbed.captured)
+            grabbed.hash = hash_frame(grabbed.frame);
+          callback(std::move(grabbed));
+        });
+  }
+  // encodes a frame from grab_raw_frame the way grab_frame_buffer would
+  virtual void encode_raw_frame(raw_frame_t const &frame, image_data_t &image) {
+    write_png(const_cast<unsigned char *>(frame.data.data()), frame.width,
+              frame.height, frame.stride, frame.bpp, frame.rgb, image);
+  }
+  // a cheap value that changes whenever the screen shows a new frame, or
+  // nothing if the backend can't tell without grabbing the frame
+  virtual std::optional<uint64_t> frame_token(int) { return std::nullopt; }
 };
 } // namespace qadx
\ No newline at end of file
@@ -28,13 +28,46 @@
 #include "backends/input/evdev.hpp"
 #include "backends/input/uinput.hpp"
 #include "base_screen.hpp"
+#include <atomic>
+#include <boost/asio/thread_pool.hpp>
+#include <functional>
 #include <ilmControl/ivi-wm-client-protocol.h>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <wayland-client.h>
 
 namespace qadx {
 
+struct ivi_rectangle_t {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+struct ivi_surface_t {
+  int width = 0; // of the buffer the application attached
+  int height = 0;
+  bool visible = false;
+  ivi_rectangle_t destination{};
+};
+
+struct ivi_layer_t {
+  bool visible = false;
+  ivi_rectangle_t destination{};
+  std::vector<uint32_t> surfaces{}; // bottom to top
+};
+
+// the ivi layers and surfaces, as told by the compositor
+struct ivi_scene_t {
+  std::map<uint32_t, ivi_surface_t> surfaces{};
+  std::map<uint32_t, ivi_layer_t> layers{};
+  std::map<int, std::vector<uint32_t>> screen_layers{}; // bottom to top
+};
+
 struct wayland_screen_t {
   wl_output *output = nullptr;
   ivi_wm_screen *wm_screen = nullptr;
@@ -43,6 +76,8 @@ struct wayland_screen_t {
   int offset_x = 0;
   int offset_y = 0;
   int screen_id = 0;
+  uint32_t global_name = 0; // of the wl_output in the registry
+  ivi_scene_t *scene = nullptr;
   wl_list wy_link{};
 };
 
@@ -52,27 +87,75 @@ struct wayland_data_t {
   wl_registry *registry = nullptr;
   ivi_wm *wm = nullptr;
   wl_list output_list{};
+  ivi_scene_t scene{};
 };
 
 struct screenshot_t {
-  qad_screen_buffer_t data{};
+  raw_frame_t *raw_frame = nullptr; // the pixels are copied unconverted
+  // or else converted straight into this BMP, without a copy in between
+  image_data_t *image = nullptr;
+  uint64_t hash = 0; // hash_frame of the pixels, when converted
   int width = 0;
   int height = 0;
   int stride = 0;
   int done = 0;
 };
 
+// screenshots asked for together, completed once all of them are done
+struct screenshot_batch_t {
+  std::vector<int> screens{};
+  std::vector<screenshot_t> screen_shots{};
+  std::vector<raw_frame_t> frames{}; // for grab_raw_frames_async
+  bool surfaces = false; // `screens` holds ivi surface ids
+  bool requested = false;
+  // called on the dispatch thread, must not block it
+  std::function<void(screenshot_batch_t &)> done{};
+};
+
 struct ilm_screen_t final : public base_screen_t {
   static ilm_screen_t *create_global_instance();
 
-  std::string list_screens() final { return {}; }
+  std::string list_screens() final;
   bool grab_frame_buffer(image_data_t &screen_buffer, int screen) final;
+  bool grab_raw_frame(raw_frame_t &frame, int screen) final;
+  std::vector<int> screen_ids() final;
+  void grab_raw_frames(std::vector<int> const &screens,
+                       std::vector<raw_frame_t> &frames) final;
+  void grab_raw_frames_async(std::vector<int> const &screens,
+                             raw_frames_callback_t callback) final;
+  void grab_screenshot_async(int screen,
+                             screenshot_grab_callback_t callback) final;
+  bool concurrent_grabs() const final { return true; }
+  // a copy of the scene graph as it is now
+  ivi_scene_t scene();
+  // captures one ivi surface, without what's composited around or over it
+  void grab_surface_async(uint32_t surface_id, raw_frames_callback_t callback);
+  // captures what an ivi layer shows on its screen
+  void grab_layer_async(uint32_t layer_id, raw_frames_callback_t callback);
+  void encode_raw_frame(raw_frame_t const &frame, image_data_t &image) final;
   ~ilm_screen_t() override;
 
 private:
   friend std::unique_ptr<ilm_screen_t> create_instance();
-  explicit ilm_screen_t(wayland_data_t &&wd)
-      : base_screen_t{}, wayland_data(std::move(wd)) {}
+  ilm_screen_t() = default;
+  bool take_screenshot(screenshot_t &screen_shot, int screen);
+  bool take_screenshots(std::vector<int> const &screens,
+                        std::vector<screenshot_t> &screen_shots);
+  void submit(std::unique_ptr<screenshot_batch_t> batch);
+  void submit_async(std::vector<int> const &ids, bool surfaces,
+                    raw_frames_callback_t callback);
+  void request_screenshots(screenshot_batch_t &batch);
+  void dispatch();
+
+  // guards the output list and the submitted batches against the dispatch
+  // thread, which owns the event queue
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<screenshot_batch_t>> m_submitted{};
+  std::atomic_bool m_running = false;
+  int m_wakeFd = -1;
+  std::thread m_dispatchThread{};
+  // grab_raw_frames_async callbacks run here, away from the dispatch thread
+  boost::asio::thread_pool m_completions{2};
   wayland_data_t wayland_data{};
 };
 } // namespace qadx
\ No newline at end of file
@@ -26,6 +26,8 @@
 #pragma once
 
 #include "base_screen.hpp"
+#include <array>
+#include <functional>
 #include <memory>
 
 namespace qadx {
@@ -33,10 +35,21 @@ namespace details {
 struct kms_screen_crtc_t {
   uint32_t id = 0;
   int valid_mode = 0;
+  uint32_t buffer_id = 0; // 0 when no frame buffer is attached
+};
+
+// a linear frame buffer mapped for reading, planes in fourcc order
+struct kms_frame_buffer_t {
+  uint32_t format = 0;
+  int width = 0;
+  int height = 0;
+  std::array<frame_plane_t, 4> planes{};
 };
 } // namespace details
 
 using string_list_t = std::vector<std::string>;
+using frame_buffer_callback_t =
+    std::function<void(details::kms_frame_buffer_t const &)>;
 
 struct kms_screen_t final : public base_screen_t {
   static kms_screen_t *
@@ -45,6 +58,11 @@ struct kms_screen_t final : public base_screen_t {
 
   std::string list_screens() final;
   bool grab_frame_buffer(image_data_t &screen_buffer, int screen) final;
+  bool grab_raw_frame(raw_frame_t &frame, int screen) final;
+  std::optional<uint64_t> frame_token(int screen) final;
+  std::vector<int> screen_ids() final;
+  // every grab opens the card on its own
+  bool concurrent_grabs() const final { return true; }
   ~kms_screen_t() override = default;
 
 private:
@@ -54,6 +72,8 @@ private:
                                               int use_rgb);
   kms_screen_t() : base_screen_t() {}
   std::vector<details::kms_screen_crtc_t> list_screens_impl();
+  bool probe();
+  bool map_frame_buffer(int screen_id, frame_buffer_callback_t const &callback);
   std::string m_card = "/dev/dri/";
 };
 } // namespace qadx
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "base_screen.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <wayland-client.h>
+#include <weston-screenshooter-client-protocol.h>
+#include <wlr-screencopy-unstable-v1-client-protocol.h>
+
+namespace qadx {
+
+struct screencopy_output_t {
+  wl_output *output = nullptr;
+  uint32_t global_name = 0; // of the wl_output in the registry
+  int screen_id = 0;
+  int width = 0; // of the current mode
+  int height = 0;
+  // the global went away, kept until no capture refers to the output
+  bool removed = false;
+
+  // the buffer every capture of this output is copied into, recreated only
+  // when the compositor asks for another size or format
+  wl_buffer *buffer = nullptr;
+  void *memory = nullptr;
+  std::size_t size = 0;
+  uint32_t format = 0; // wl_shm format
+  int buffer_width = 0;
+  int buffer_height = 0;
+  int stride = 0;
+};
+
+// Captures the outputs of compositors without ivi-shell, through wlroots'
+// screencopy or, failing that, Weston's screenshooter. The latter is only
+// offered to clients when Weston runs with --debug.
+struct screencopy_screen_t final : public base_screen_t {
+  static screencopy_screen_t *create_global_instance();
+
+  std::string list_screens() final;
+  bool grab_frame_buffer(image_data_t &screen_buffer, int screen) final;
+  bool grab_raw_frame(raw_frame_t &frame, int screen) final;
+  std::vector<int> screen_ids() final;
+  ~screencopy_screen_t() override;
+
+private:
+  friend std::unique_ptr<screencopy_screen_t> create_screencopy_instance();
+  friend void screencopy_registry_handler(void *, wl_registry *, uint32_t,
+                                          char const *, uint32_t);
+  friend void screencopy_registry_remover(void *, wl_registry *, uint32_t);
+  friend void screenshooter_done(void *, weston_screenshooter *);
+  screencopy_screen_t() = default;
+
+  bool ensure_shm_buffer(screencopy_output_t &output, uint32_t format,
+                         int width, int height, int stride);
+  // copies the output's next frame into its buffer
+  bool capture(screencopy_output_t &output, bool &y_invert);
+  bool dispatch_until(bool const &condition);
+  void erase_removed_outputs();
+
+  // captures share the event queue and each output's buffer
+  std::mutex m_mutex;
+  wl_display *m_display = nullptr;
+  wl_event_queue *m_queue = nullptr;
+  wl_registry *m_registry = nullptr;
+  wl_shm *m_shm = nullptr;
+  zwlr_screencopy_manager_v1 *m_screencopy = nullptr;
+  weston_screenshooter *m_screenshooter = nullptr;
+  bool m_shooterDone = false;
+  int m_nextScreenId = 0;
+  std::vector<std::unique_ptr<screencopy_output_t>> m_outputs{};
+};
+} // namespace qadx
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "arguments.hpp"
+#include "base_screen.hpp"
+#include <chrono>
+#include <memory>
+
+namespace qadx {
+// Serves frames from memory instead of display hardware, so the capture,
+// encode and HTTP paths can be measured anywhere. The frames are kept in
+// their pixel format in a read-only mapping (a memfd, or the source file
+// itself for raw frames) and go through the same conversion as KMS frames.
+struct synthetic_screen_t final : public base_screen_t {
+  static synthetic_screen_t *
+  create_global_instance(synthetic_args_t const &args);
+
+  std::string list_screens() final;
+  bool grab_frame_buffer(image_data_t &screen_buffer, int screen) final;
+  bool grab_raw_frame(raw_frame_t &frame, int screen) final;
+  // the index of the frame on screen
+  std::optional<uint64_t> frame_token(int screen) final;
+  std::vector<int> screen_ids() final;
+  // frames are only ever read
+  bool concurrent_grabs() const final { return true; }
+  ~synthetic_screen_t() override;
+
+private:
+  friend std::unique_ptr<synthetic_screen_t>
+  create_instance(synthetic_args_t const &args);
+  explicit synthetic_screen_t(synthetic_args_t const &args)
+      : base_screen_t(), m_args(args) {}
+  std::size_t frame_index() const;
+
+  synthetic_args_t m_args;
+  std::size_t m_frameSize = 0;
+  std::size_t m_frameCount = 0;
+  void *m_frames = nullptr;
+  std::size_t m_mappedSize = 0;
+  std::chrono::steady_clock::time_point const m_start =
+      std::chrono::steady_clock::now();
+};
+} // namespace qadx
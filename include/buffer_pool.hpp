@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace qadx {
+namespace details {
+void *allocate_pixels(std::size_t bytes);
+void free_pixels(void *pointer, std::size_t bytes);
+} // namespace details
+
+// Allocator of the pixel and encoded image buffers. Elements are default
+// initialised, so resizing a buffer that's about to be overwritten doesn't
+// zero it first, and large buffers come straight from mmap, 2MiB aligned and
+// optionally advised to be backed by transparent huge pages.
+template <typename T> struct pixel_allocator_t {
+  using value_type = T;
+
+  pixel_allocator_t() = default;
+  template <typename U>
+  pixel_allocator_t(pixel_allocator_t<U> const &) noexcept {}
+
+  T *allocate(std::size_t const n) {
+    return static_cast<T *>(details::allocate_pixels(n * sizeof(T)));
+  }
+  void deallocate(T *pointer, std::size_t const n) noexcept {
+    details::free_pixels(pointer, n * sizeof(T));
+  }
+
+  template <typename U> void construct(U *pointer) noexcept {
+    ::new (static_cast<void *>(pointer)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U *pointer, Args &&...args) {
+    ::new (static_cast<void *>(pointer)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U> bool operator==(pixel_allocator_t<U> const &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(pixel_allocator_t<U> const &) const {
+    return false;
+  }
+};
+
+using qad_screen_buffer_t =
+    std::vector<unsigned char, pixel_allocator_t<unsigned char>>;
+
+// Buffers that go back and forth between the capture, conversion and encode
+// stages. A released buffer keeps its capacity and is handed out again to
+// the next request it's large enough, but no more than twice as large, for.
+// Once the pool has warmed up for the screens' resolutions, screenshots stop
+// allocating.
+class buffer_pool_t {
+  std::mutex m_mutex;
+  std::multimap<std::size_t, qad_screen_buffer_t> m_buffers; // by capacity
+  std::size_t m_pooledBytes = 0;
+
+public:
+  static buffer_pool_t &instance();
+  static void use_huge_pages(bool enable);
+
+  // a buffer of `size` bytes, uninitialised
+  qad_screen_buffer_t acquire(std::size_t size);
+  // an empty buffer with room for at least `capacity` bytes
+  qad_screen_buffer_t acquire_empty(std::size_t capacity);
+  void release(qad_screen_buffer_t &&buffer);
+};
+
+// resizes `buffer`, swapping it for a pooled one when it's too small
+void ensure_buffer_size(qad_screen_buffer_t &buffer, std::size_t size);
+} // namespace qadx
@@ -72,7 +72,9 @@ class endpoint_t {
   };
 
   std::map<std::string, rule_t> m_endpoints;
-  std::map<std::string, special_placeholders_t> m_specialEndpoints;
+  // several special routes may share a prefix, e.g. "/screen/{id}" and
+  // "/screen/{id}/stream"; they are told apart by placeholder count & suffix
+  std::multimap<std::string, special_placeholders_t> m_specialEndpoints;
   using rule_iterator = std::map<std::string, rule_t>::iterator;
 
   void construct_special_placeholder(special_placeholders_t &,
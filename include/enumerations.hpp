@@ -29,18 +29,28 @@ namespace qadx {
 enum class input_type_e {
   evdev,
   uinput,
+  record,
   none,
 };
 
 enum class screen_type_e {
   ilm,
   kms,
+  synthetic,
+  screencopy,
   none,
 };
 
+enum class capture_policy_e {
+  on_demand,
+  periodic,
+  change_triggered,
+};
+
 enum class image_type_e {
   png,
   bmp,
+  jpeg,
   none,
 };
 
@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "image.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+
+namespace qadx {
+// Content-addressed store of screenshots: every distinct frame is written
+// once, as PNG, under the hex form of its hash_frame value (its frame id).
+class frame_archive_t {
+  std::filesystem::path const m_directory;
+  mutable std::mutex m_mutex;
+  mutable std::unordered_set<uint64_t> m_known;
+  std::atomic<uint64_t> m_nextTemp = 0; // names the files being written
+
+  explicit frame_archive_t(std::filesystem::path directory)
+      : m_directory(std::move(directory)) {}
+  std::filesystem::path path_of(std::string const &frame_id) const;
+
+public:
+  static frame_archive_t *create_global_instance(std::string const &directory);
+  static std::string frame_id(uint64_t hash);
+  bool contains(uint64_t hash) const;
+  // archives the frame unless it already is, `encoded` is written as is
+  // when it's a PNG. `frame` may be left empty when `encoded` is a BMP of
+  // it. Returns the frame id, empty when it couldn't be stored.
+  std::string store(uint64_t hash, raw_frame_t const &frame,
+                    image_data_t const *encoded = nullptr);
+  // nullopt for an unknown or malformed frame id
+  std::optional<std::filesystem::path> find(std::string const &frame_id) const;
+};
+} // namespace qadx
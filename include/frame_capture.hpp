@@ -0,0 +1,227 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "backends/screen/base_screen.hpp"
+#include "enumerations.hpp"
+#include "frame_archive.hpp"
+
+#include <boost/asio/thread_pool.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace qadx {
+// worker threads for the grabs and encodes that mustn't hold up the io
+// threads
+boost::asio::thread_pool &capture_pool();
+
+// invoked with a nullptr image when the frame couldn't be encoded, and an
+// empty id when it couldn't be archived or there's no archive
+using encoded_frame_callback_t = std::function<void(
+    std::shared_ptr<image_data_t const> image, std::string const &frame_id)>;
+
+// the PNG of a captured frame and its archive id, see encode_captured_frame
+struct frame_encoding_t {
+  std::mutex mutex;
+  bool started = false;
+  bool done = false;
+  std::shared_ptr<image_data_t const> image = nullptr;
+  std::string frame_id{};
+  std::vector<encoded_frame_callback_t> waiters{};
+};
+
+struct captured_frame_t {
+  raw_frame_t frame{};
+  uint64_t sequence = 0;
+  uint64_t hash = 0; // see hash_frame
+  std::chrono::system_clock::time_point timestamp{};
+  // a new one for every frame published into the slot
+  std::shared_ptr<frame_encoding_t> encoding = nullptr;
+};
+
+using captured_frame_ptr = std::shared_ptr<captured_frame_t const>;
+// invoked with nullptr when no suitable frame arrived before the deadline
+using frame_callback_t = std::function<void(captured_frame_ptr)>;
+
+// Fixed-size ring of the most recent frames of one screen. Slots are reused
+// for new captures unless a reader still holds on to them.
+class frame_ring_t {
+  struct waiter_t {
+    uint64_t sequence = 0;
+    std::chrono::steady_clock::time_point deadline{};
+    frame_callback_t callback;
+  };
+
+  mutable std::mutex m_mutex;
+  std::vector<std::shared_ptr<captured_frame_t>> m_slots;
+  std::size_t m_next = 0;
+  uint64_t m_sequence = 0;
+  std::shared_ptr<captured_frame_t> m_newest = nullptr;
+  std::vector<waiter_t> m_waiters;
+  bool m_active = true;
+
+public:
+  explicit frame_ring_t(std::size_t capacity);
+  std::shared_ptr<captured_frame_t> acquire_slot();
+  void publish(std::shared_ptr<captured_frame_t> const &frame);
+  void expire_waiters();
+  captured_frame_ptr newest() const;
+  // an inactive ring has no frames and fails its waiters straight away
+  void set_active(bool active);
+  // calls `callback` with the first frame whose sequence is greater than
+  // `sequence`, right away if the ring already has one
+  void when_newer_than(uint64_t sequence,
+                       std::chrono::steady_clock::duration timeout,
+                       frame_callback_t callback);
+};
+
+// Hands `callback` the PNG of `frame`, and its id once stored in `archive`
+// when there's one. The first request for a frame encodes it on a worker
+// thread and every other shares the result: `callback` is invoked right
+// away when it's ready already, from that worker otherwise.
+void encode_captured_frame(captured_frame_ptr const &frame,
+                           frame_archive_t *archive,
+                           encoded_frame_callback_t callback);
+
+struct capture_policy_t {
+  capture_policy_e policy = capture_policy_e::on_demand;
+  // capture rate when periodic, how often the screen is checked for a new
+  // frame when change triggered
+  int fps = 10;
+};
+
+char const *to_string(capture_policy_e policy);
+std::optional<capture_policy_e> to_capture_policy(std::string const &name);
+
+// One thread per screen, grabbing frames into a ring at a fixed rate, or
+// whenever the backend reports a new frame. The thread gives up, and leaves
+// the ring inactive, once every grab has failed for a few seconds.
+class screen_capture_t {
+  base_screen_t *const m_screen;
+  int const m_screenId;
+  capture_policy_e const m_policy;
+  std::chrono::steady_clock::duration const m_interval;
+  std::shared_ptr<frame_ring_t> const m_ring;
+  std::atomic_bool m_stopped = false;
+  std::atomic_bool m_failed = false;
+  std::mutex m_mutex;
+  std::condition_variable m_stopCondition;
+  std::thread m_thread;
+
+  void capture_loop();
+
+public:
+  screen_capture_t(base_screen_t *screen, int screen_id,
+                   capture_policy_t const &policy,
+                   std::shared_ptr<frame_ring_t> ring);
+  ~screen_capture_t();
+  // the thread gave up on the screen
+  bool failed() const { return m_failed; }
+};
+
+struct burst_frame_t {
+  std::shared_ptr<image_data_t> image = nullptr; // from the buffer pool
+  uint64_t hash = 0; // see hash_frame
+  std::chrono::system_clock::time_point timestamp{};
+  std::chrono::microseconds offset{}; // since the first capture of the burst
+};
+// invoked with no frames when a capture failed
+using burst_callback_t = std::function<void(std::vector<burst_frame_t>)>;
+
+// Captures `count` frames of a screen `interval` apart, on a thread of its
+// own so the timing isn't at the mercy of the io threads. Frames are encoded
+// on a second thread as they come in, and `callback` is invoked from the
+// capturing thread once all of them are. At most max_concurrent_bursts run
+// at once; false, without `callback` ever being invoked, when that many
+// already are.
+constexpr int max_concurrent_bursts = 4;
+bool capture_burst(base_screen_t *screen, int screen_id, int count,
+                   std::chrono::milliseconds interval,
+                   burst_callback_t callback);
+
+struct screen_frame_t {
+  int screen_id = 0;
+  bool captured = false;
+  raw_frame_t frame{};  // empty once encoded
+  image_data_t image{}; // only when asked to encode
+  uint64_t hash = 0;    // see hash_frame
+  std::chrono::system_clock::time_point timestamp{};
+  std::chrono::microseconds offset{}; // since the first capture started
+};
+using screens_callback_t = std::function<void(std::vector<screen_frame_t>)>;
+
+// Captures all of `screen_ids` at once on a pool of worker threads, then
+// hashes and, when `encode` is set, encodes them in parallel. Backends that
+// can't grab concurrently get all the screens asked for in one batch.
+// `callback` is invoked from a worker thread, with one frame per screen in
+// the order of `screen_ids`.
+void capture_screens(base_screen_t *screen, std::vector<int> screen_ids,
+                     bool encode, screens_callback_t callback);
+
+class capture_service_t {
+  struct screen_state_t {
+    capture_policy_t policy{};
+    std::shared_ptr<frame_ring_t> ring = nullptr;
+    std::unique_ptr<screen_capture_t> capture = nullptr;
+  };
+
+  base_screen_t *const m_screen;
+  capture_policy_t const m_defaultPolicy;
+  std::size_t const m_ringSize;
+  std::mutex m_mutex;
+  // only screens the backend has, a client can't make up more of them
+  std::map<int, screen_state_t> m_screens;
+
+  capture_service_t(base_screen_t *screen, capture_policy_t const &policy,
+                    std::size_t ring_size)
+      : m_screen(screen), m_defaultPolicy(policy), m_ringSize(ring_size) {}
+  // nullptr when the backend has no such screen
+  screen_state_t *screen_state(int screen_id);
+
+public:
+  static capture_service_t *
+  create_global_instance(base_screen_t *screen,
+                         capture_policy_t const &default_policy,
+                         std::size_t ring_size);
+  // nullptr when the screen is captured on demand or doesn't exist.
+  // Otherwise the capture of the screen starts the first time it's asked
+  // for, and again after it gave up.
+  std::shared_ptr<frame_ring_t> ring(int screen_id);
+  // nullopt, and no change, when the screen doesn't exist
+  std::optional<capture_policy_t> policy(int screen_id);
+  bool set_policy(int screen_id, capture_policy_t const &policy);
+};
+} // namespace qadx
@@ -25,7 +25,10 @@
 
 #pragma once
 
+#include "buffer_pool.hpp"
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace qadx {
@@ -53,14 +56,68 @@ struct BMPHeader {
 };
 #pragma pack(pop)
 
-using qad_screen_buffer_t = std::vector<unsigned char>;
 struct image_data_t {
   qad_screen_buffer_t buffer;
   image_type_e type;
 };
+// an image whose buffer goes back to the buffer pool once it's released
+std::shared_ptr<image_data_t> make_pooled_image();
+
+// unencoded pixels as scanned out by the screen backend, top row first.
+// bpp/rgb carry the same meaning as in write_png.
+struct raw_frame_t {
+  qad_screen_buffer_t data;
+  int width = 0;
+  int height = 0;
+  int stride = 0;
+  int bpp = 32;
+  int rgb = 0;
+};
+
+// one plane of a frame buffer in a DRM fourcc format, see convert_frame
+struct frame_plane_t {
+  void const *data = nullptr;
+  int pitch = 0;
+};
+
+struct frame_rect_t {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
 
 int encode_bmp(qad_screen_buffer_t const &data, int width, int height,
                int stride, image_data_t &screen_buffer);
+// writes the header of a 32bpp BMP and returns where its bottom-up rows of
+// `stride` bytes go, for encoders that write them in place
+unsigned char *begin_bmp(int width, int height, int stride,
+                         image_data_t &screen_buffer);
+// a negative `pitch` reads the rows upwards from `ptr`, the last row of
+// a bottom-up image such as a BMP
 void write_png(void *ptr, int width, int height, int pitch, int bpp, int rgb,
                image_data_t &screen_buffer);
+void write_jpeg(raw_frame_t const &frame, int quality,
+                image_data_t &screen_buffer);
+// converts a frame buffer in the DRM fourcc `format` into the 32bpp BGRX
+// layout every encoder takes. Returns false when there's no converter for
+// `format`, which leaves `frame` untouched.
+bool convert_frame(uint32_t format, frame_plane_t const *planes, int width,
+                   int height, raw_frame_t &frame);
+bool can_convert_frame(uint32_t format);
+// decodes a PNG file into 32bpp BGRX, false when it can't be read
+bool read_png(std::string const &path, raw_frame_t &frame);
+// compares both frames tile by tile and returns the areas that changed, with
+// horizontally adjacent dirty tiles of the same tile row merged together.
+// Frames of different geometry are reported as one full-frame rectangle.
+std::vector<frame_rect_t> find_dirty_tiles(raw_frame_t const &previous,
+                                           raw_frame_t const &current,
+                                           int tile_size);
+// 64-bit content hash of the visible pixels of a frame, stride padding is
+// ignored. Not cryptographic, only meant to tell frames apart.
+uint64_t hash_frame(raw_frame_t const &frame);
+// hash_frame of pixels that aren't in a raw frame, such as a backend's
+// shared memory buffer
+uint64_t hash_pixels(unsigned char const *pixels, int width, int height,
+                     int stride, int bpp, int rgb);
 } // namespace qadx
\ No newline at end of file
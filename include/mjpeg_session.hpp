@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/serializer.hpp>
+#include <boost/beast/http/string_body.hpp>
+
+#include <memory>
+#include <optional>
+
+#include "backends/screen/base_screen.hpp"
+
+namespace qadx {
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+// Serves a multipart/x-mixed-replace stream of JPEG frames on a connection
+// taken over from session_t. Frames are grabbed and encoded on a worker
+// thread. At most one frame is ever in flight; ticks that fire while the
+// previous frame is still being encoded or received are dropped.
+class mjpeg_session_t : public std::enable_shared_from_this<mjpeg_session_t> {
+  using empty_response_t = http::response<http::empty_body>;
+
+  beast::tcp_stream m_tcpStream;
+  net::steady_timer m_timer;
+  base_screen_t *const m_screen;
+  int const m_screenId;
+  int const m_quality;
+  std::chrono::steady_clock::duration const m_interval;
+  std::optional<empty_response_t> m_headerResponse = std::nullopt;
+  std::optional<http::response_serializer<http::empty_body>>
+      m_headerSerializer = std::nullopt;
+  raw_frame_t m_rawFrame{};
+  image_data_t m_jpegFrame{};
+  std::string m_partHeader{};
+  bool m_writing = false;
+  std::size_t m_framesSent = 0;
+  std::size_t m_framesDropped = 0;
+
+  void on_header_written(beast::error_code ec);
+  void schedule_next_frame();
+  void on_timer_expired(beast::error_code ec);
+  void on_frame_encoded(bool encoded);
+  void on_frame_written(beast::error_code ec);
+  void shutdown_socket();
+
+public:
+  mjpeg_session_t(beast::tcp_stream &&stream, base_screen_t *screen,
+                  int screen_id, int fps, int quality);
+  ~mjpeg_session_t();
+  void run(http::request<http::string_body> const &request);
+};
+} // namespace qadx
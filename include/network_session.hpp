@@ -27,9 +27,9 @@
 
 #include <boost/beast/core/flat_buffer.hpp>
 #include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/buffer_body.hpp>
 #include <boost/beast/http/dynamic_body.hpp>
 #include <boost/beast/http/empty_body.hpp>
-#include <boost/beast/http/file_body.hpp>
 #include <boost/beast/http/parser.hpp>
 #include <boost/beast/http/serializer.hpp>
 #include <boost/beast/http/string_body.hpp>
@@ -42,8 +42,11 @@
 
 #include "arguments.hpp"
 #include "endpoint.hpp"
-#include "field_allocs.hpp"
+#include "frame_archive.hpp"
+#include "frame_capture.hpp"
+#include "recorder.hpp"
 #include <backends/input.hpp>
+#include <backends/screen/base_screen.hpp>
 
 #define ROUTE_CALLBACK(callback)                                               \
   [self = shared_from_this()] BN_REQUEST_PARAM {                               \
@@ -70,12 +73,12 @@ namespace http = beast::http;
 
 using string_response_t = http::response<http::string_body>;
 using string_request_t = http::request<http::string_body>;
+using image_response_t = http::response<http::buffer_body>;
 using nlohmann::json;
 
 class session_t : public std::enable_shared_from_this<session_t> {
   using string_body_ptr =
       std::unique_ptr<http::request_parser<http::string_body>>;
-  using alloc_t = fields_alloc<char>;
 
 private:
   net::io_context &m_ioContext;
@@ -84,13 +87,9 @@ private:
   beast::flat_buffer m_buffer{};
   std::optional<http::request_parser<http::empty_body>> m_emptyBodyParser =
       std::nullopt;
-  std::optional<http::response<http::file_body, http::basic_fields<alloc_t>>>
-      m_fileResponse = std::nullopt;
-  alloc_t m_fileAlloc{8192};
-  std::optional<
-      http::response_serializer<http::file_body, http::basic_fields<alloc_t>>>
-      m_fileSerializer = std::nullopt;
   std::shared_ptr<void> m_cachedResponse = nullptr;
+  std::optional<image_response_t> m_imageResponse = std::nullopt;
+  std::shared_ptr<image_data_t const> m_cachedImage = nullptr;
   string_body_ptr m_clientRequest{nullptr};
   beast::tcp_stream m_tcpStream;
   boost::string_view m_contentType{};
@@ -107,6 +106,9 @@ private:
   void handle_requests(string_request_t const &request);
   static string_response_t json_success(json const &body,
                                         string_request_t const &req);
+  static string_response_t multipart_response(std::string &&body,
+                                              char const *boundary,
+                                              string_request_t const &req);
   static string_response_t success(char const *message,
                                    string_request_t const &);
   static string_response_t bad_request(std::string const &message,
@@ -117,6 +119,10 @@ private:
                                         string_request_t const &);
   static string_response_t get_error(std::string const &, http::status,
                                      string_request_t const &);
+  static string_response_t not_modified(uint64_t hash,
+                                        string_request_t const &);
+  static image_response_t image_response(image_data_t const &,
+                                         string_request_t const &);
   static string_response_t allowed_options(std::vector<http::verb> const &,
                                            string_request_t const &);
   static url_query_t split_optional_queries(boost::string_view const &args);
@@ -127,11 +133,35 @@ private:
   void swipe_request_handler(url_query_t const &);
   void key_request_handler(url_query_t const &);
   void text_request_handler(url_query_t const &);
+  void play_gesture_request(base_input_t *, int event, gesture_t &&);
   void screen_request_handler(url_query_t const &);
+  void ready_request_handler(url_query_t const &);
+  void input_events_request_handler(url_query_t const &);
+  void scene_request_handler(url_query_t const &);
+  void surface_request_handler(url_query_t const &);
+  void layer_request_handler(url_query_t const &);
+  void ivi_capture_request(url_query_t const &, bool surface);
   void screenshot_request_handler(url_query_t const &);
+  void burst_request(base_screen_t *, int screen_id, url_query_t const &);
+  void all_screens_request_handler(url_query_t const &);
+  void screen_stream_request_handler(url_query_t const &);
+  void screen_websocket_request_handler(url_query_t const &);
+  void capture_policy_request_handler(url_query_t const &);
+  void record_start_request_handler(url_query_t const &);
+  void record_stop_request_handler(url_query_t const &);
+  void recorded_frame_request_handler(url_query_t const &);
+  void archived_frame_request_handler(url_query_t const &);
   bool is_closed();
 
-  void send_file(std::filesystem::path const &, string_request_t const &);
+  void send_image(image_response_t &&, std::shared_ptr<image_data_t const>);
+  void send_captured_frame(captured_frame_ptr const &);
+  void send_encoded_frame(captured_frame_ptr const &, bool has_frame,
+                          std::shared_ptr<image_data_t const> image,
+                          std::string const &frame_id);
+  void send_burst(std::vector<burst_frame_t> const &);
+  void send_screens(std::vector<screen_frame_t> const &);
+  void send_screens_manifest(std::vector<screen_frame_t> const &,
+                             std::vector<std::string> const &frame_ids);
 
 public:
   session_t(net::io_context &io, net::ip::tcp::socket &&socket,
@@ -142,4 +172,15 @@ public:
   void run() { http_read_data(); }
 };
 
+// creates both backends up front and primes the screen capture path, so no
+// request pays for it. Returns false when a backend is unusable.
+bool warm_up_backends(runtime_args_t const &args);
+base_screen_t *get_screen_object(runtime_args_t const &args);
+base_input_t *get_input_object(runtime_args_t const &args);
+// the record input backend, or nullptr when another one is in use
+record_backend_t *get_input_recorder(runtime_args_t const &args);
+capture_service_t *get_capture_service(runtime_args_t const &args);
+recording_service_t *get_recording_service(runtime_args_t const &args);
+frame_archive_t *get_frame_archive(runtime_args_t const &args);
+
 } // namespace qadx
\ No newline at end of file
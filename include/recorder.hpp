@@ -0,0 +1,156 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "backends/screen/base_screen.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Recording file layout, all integers little endian:
+//
+//   file header   "QADXREC1", u16 version, u16 tile size, u32 reserved
+//   frame records one per captured frame, see recording_frame_header_t; the
+//                 payload is zstd-compressed and holds `rects` rectangles of
+//                 u16 x, y, width, height followed by their pixel rows
+//   seek index    one recording_index_entry_t per frame
+//   footer        u64 index offset, u32 frame count, u32 reserved, "QADXIDX1"
+//
+// Keyframes carry one full-frame rectangle, delta frames the tiles that
+// changed since the previous frame. The index and footer are only written
+// when the recording is stopped.
+namespace qadx {
+#pragma pack(push, 1)
+struct recording_frame_header_t {
+  uint8_t type{}; // 0 keyframe, 1 delta
+  uint8_t rgb{};
+  uint8_t bpp{};
+  uint8_t reserved{};
+  uint32_t sequence{};
+  uint64_t timestamp_us{}; // since the epoch
+  uint16_t width{};
+  uint16_t height{};
+  uint16_t rects{};
+  uint16_t reserved2{};
+  uint32_t compressed_size{};
+  uint32_t payload_size{};
+};
+
+struct recording_index_entry_t {
+  uint64_t offset{};
+  uint64_t timestamp_us{};
+  uint32_t sequence{};
+  uint8_t type{};
+  uint8_t reserved[3]{};
+};
+#pragma pack(pop)
+
+struct recording_options_t {
+  int fps = 10;
+  int keyframe_interval = 100;
+  int tile_size = 64;
+  int compression_level = 3;
+};
+
+struct recording_info_t {
+  std::string path;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+};
+
+// Captures one screen on its own thread and appends it to a recording file.
+class screen_recorder_t {
+  base_screen_t *const m_screen;
+  int const m_screenId;
+  recording_options_t const m_options;
+  std::string const m_path;
+  std::ofstream m_file;
+  std::vector<recording_index_entry_t> m_index;
+  std::atomic<uint64_t> m_frames = 0;
+  std::atomic<uint64_t> m_bytes = 0;
+  std::atomic_bool m_stopped = false;
+  std::mutex m_mutex;
+  std::condition_variable m_stopCondition;
+  std::thread m_thread;
+
+  void record_loop();
+  void finish();
+
+public:
+  // throws std::runtime_error when the file can't be created
+  screen_recorder_t(base_screen_t *screen, int screen_id, std::string path,
+                    recording_options_t const &options);
+  ~screen_recorder_t();
+  // joins the recording thread and writes the seek index
+  void stop();
+  recording_info_t info() const;
+};
+
+class recording_service_t {
+  base_screen_t *const m_screen;
+  std::filesystem::path const m_directory;
+  std::mutex m_mutex;
+  std::map<int, std::unique_ptr<screen_recorder_t>> m_recordings;
+
+  recording_service_t(base_screen_t *screen, std::filesystem::path directory)
+      : m_screen(screen), m_directory(std::move(directory)) {}
+
+public:
+  static recording_service_t *
+  create_global_instance(base_screen_t *screen, std::string const &directory);
+  // nullopt when the screen is already being recorded
+  std::optional<recording_info_t> start(int screen_id,
+                                        recording_options_t const &options);
+  // nullopt when the screen isn't being recorded
+  std::optional<recording_info_t> stop(int screen_id);
+  std::filesystem::path const &directory() const { return m_directory; }
+};
+
+// Random access to the frames of a finished recording, through its index.
+class recording_reader_t {
+  std::ifstream m_file;
+  std::vector<recording_index_entry_t> m_index;
+
+public:
+  // throws std::runtime_error on a missing or truncated recording
+  explicit recording_reader_t(std::filesystem::path const &path);
+  std::size_t frame_count() const { return m_index.size(); }
+  recording_index_entry_t const &entry(std::size_t n) const {
+    return m_index[n];
+  }
+  // decodes from the closest keyframe at or before `n`
+  bool read_frame(std::size_t n, raw_frame_t &frame);
+};
+} // namespace qadx
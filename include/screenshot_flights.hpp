@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "backends/screen/base_screen.hpp"
+#include "frame_archive.hpp"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace qadx {
+using shared_image_t = std::shared_ptr<image_data_t const>;
+
+// the entity tags of an If-None-Match header, "*" matching any frame
+struct entity_tags_t {
+  bool any = false;
+  std::vector<uint64_t> hashes{};
+
+  bool matches(uint64_t const hash) const {
+    return any ||
+           std::find(hashes.cbegin(), hashes.cend(), hash) != hashes.cend();
+  }
+};
+
+struct screenshot_result_t {
+  bool captured = false;
+  uint64_t hash = 0; // see hash_frame
+  // the requester already has the frame with this hash
+  bool not_modified = false;
+  // nullptr when not modified, or when the frame couldn't be encoded
+  shared_image_t image = nullptr;
+  std::string frame_id{}; // set once the frame is in the archive
+};
+using screenshot_callback_t = std::function<void(screenshot_result_t)>;
+
+// Single-flight screenshots: the first request for a screen grabs it, and
+// requests for the same screen arriving meanwhile are queued and share the
+// same result. The frame is only encoded if one of them needs the pixels,
+// i.e. doesn't already know its content hash. Frames are also stored in the
+// archive, when there's one.
+class screenshot_flights_t {
+  struct waiter_t {
+    entity_tags_t known_hashes;
+    screenshot_callback_t callback;
+  };
+
+  base_screen_t *m_screen;
+  frame_archive_t *m_archive;
+  std::mutex m_mutex;
+  std::map<int, std::vector<waiter_t>> m_inFlight;
+
+  screenshot_flights_t(base_screen_t *screen, frame_archive_t *archive)
+      : m_screen(screen), m_archive(archive) {}
+  // hands the grabbed frame, not captured if the grab failed, to every
+  // waiter
+  void complete(int screen_id, grabbed_screenshot_t grabbed);
+
+public:
+  static screenshot_flights_t *
+  create_global_instance(base_screen_t *screen, frame_archive_t *archive);
+  // the capture starts on the calling thread when no other is in flight and
+  // only blocks it if the backend can't grab asynchronously. Callbacks are
+  // invoked from whichever thread completed it
+  void request(int screen_id, entity_tags_t known_hashes,
+               screenshot_callback_t callback);
+};
+} // namespace qadx
@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/error.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <zlib.h>
+
+#include "arguments.hpp"
+#include "backends/input/base_input.hpp"
+#include "backends/screen/base_screen.hpp"
+
+namespace qadx {
+namespace net = boost::asio;
+namespace beast = boost::beast;
+
+namespace details {
+struct rfb_pixel_format_t {
+  uint8_t bpp = 32;
+  uint8_t depth = 24;
+  uint8_t big_endian = 0;
+  uint8_t true_colour = 1;
+  uint16_t red_max = 255;
+  uint16_t green_max = 255;
+  uint16_t blue_max = 255;
+  uint8_t red_shift = 16;
+  uint8_t green_shift = 8;
+  uint8_t blue_shift = 0;
+};
+
+// what the client asked for with SetPixelFormat and SetEncodings
+struct rfb_client_settings_t {
+  rfb_pixel_format_t pixel_format{};
+  int preferred_encoding = 0; // raw
+  bool copy_rect_supported = false;
+  bool desktop_size_supported = false;
+};
+} // namespace details
+
+// A single RFB (VNC) client. Framebuffer updates are taken from the screen
+// backend on a timer, built on a worker thread, and only sent while the
+// client has an update request outstanding; input events are forwarded to
+// the input backend.
+class vnc_session_t : public std::enable_shared_from_this<vnc_session_t> {
+  using tcp = net::ip::tcp;
+  using buffer_t = std::vector<unsigned char>;
+
+  tcp::socket m_socket;
+  net::steady_timer m_timer;
+  runtime_args_t const &m_args;
+  base_screen_t *m_screen = nullptr;
+  base_input_t *m_input = nullptr;
+  buffer_t m_readBuffer{};
+  buffer_t m_writeBuffer{};
+  raw_frame_t m_currentFrame{};
+  raw_frame_t m_clientFrame{}; // what the client's framebuffer looks like
+  details::rfb_client_settings_t m_settings{};
+  // the settings of the update being built, which client messages can't
+  // change halfway through
+  details::rfb_client_settings_t m_updateSettings{};
+  z_stream m_zrleStream{};
+  bool m_zrleStreamInitialized = false;
+  int m_protocolMinor = 8;
+  bool m_updateRequested = false;
+  bool m_fullUpdateRequested = false;
+  bool m_writing = false;
+  bool m_closed = false;
+  uint8_t m_buttonMask = 0;
+
+  template <typename Handler> void read_exactly(std::size_t size, Handler &&);
+  template <typename Handler> void write_buffer(Handler &&);
+  void on_version_read();
+  void on_security_type_read();
+  void on_client_init_read();
+  void read_message();
+  void on_message_type_read();
+  void on_set_pixel_format();
+  void on_set_encodings(std::size_t count);
+  void on_update_request();
+  void on_key_event();
+  void on_pointer_event();
+  void schedule_update();
+  void on_timer_expired(beast::error_code ec);
+  void on_update_built(bool failed, bool built);
+  // runs on a worker, along with everything it calls
+  bool build_update(bool full_update);
+  void append_rect(frame_rect_t const &rect);
+  void append_raw_rect(frame_rect_t const &rect);
+  void append_zrle_rect(frame_rect_t const &rect);
+  uint32_t translate_pixel(unsigned char const *pixel) const;
+  void append_value(buffer_t &out, uint32_t value, bool compact) const;
+  bool pixel_format_is_native() const;
+  bool apply_scroll(std::vector<frame_rect_t> &copy_rects);
+  void close_connection();
+
+public:
+  vnc_session_t(tcp::socket &&socket, runtime_args_t const &args);
+  ~vnc_session_t();
+  void run();
+};
+
+class vnc_server_t : public std::enable_shared_from_this<vnc_server_t> {
+  using tcp = net::ip::tcp;
+  net::io_context &m_ioContext;
+  tcp::acceptor m_acceptor;
+  runtime_args_t const m_args;
+  bool m_isOpen = false;
+
+public:
+  vnc_server_t(net::io_context &context, runtime_args_t args);
+  explicit operator bool() const { return m_isOpen; }
+  bool run();
+
+private:
+  void on_connection_accepted(beast::error_code ec, tcp::socket socket);
+  void accept_connections();
+};
+} // namespace qadx
@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/websocket/stream.hpp>
+
+#include <cstdint>
+#include <memory>
+
+#include "backends/screen/base_screen.hpp"
+
+namespace qadx {
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+
+struct websocket_stream_options_t {
+  int fps = 10;
+  int window = 2;             // frames allowed in flight before an ack
+  int keyframe_interval = 100; // 0 means only the first frame is a keyframe
+  int tile_size = 64;
+};
+
+// Pushes a screen as binary websocket messages: a keyframe followed by delta
+// frames carrying only the tiles that changed since the last frame sent.
+//
+// Every message starts with a 24-byte little-endian header
+//   u8 type (0 keyframe, 1 delta), u8 rgb, u16 rect count,
+//   u32 sequence, u64 capture time (us since epoch),
+//   u16 width, u16 height, u32 bytes per pixel
+// followed by, for every rect,
+//   u16 x, u16 y, u16 width, u16 height, u32 size, <size> bytes of
+//   zlib-compressed pixel rows
+//
+// Clients acknowledge frames with the JSON text message {"ack": <sequence>}
+// and may ask for a fresh keyframe with {"keyframe": true}. Frames are grabbed
+// and encoded on a worker thread. Ticks that find a frame still being built
+// or written, or `window` frames still unacknowledged, are dropped.
+class websocket_session_t
+    : public std::enable_shared_from_this<websocket_session_t> {
+  websocket::stream<beast::tcp_stream> m_websocket;
+  net::steady_timer m_timer;
+  beast::flat_buffer m_readBuffer{};
+  base_screen_t *const m_screen;
+  int const m_screenId;
+  websocket_stream_options_t const m_options;
+  std::chrono::steady_clock::duration const m_interval;
+  raw_frame_t m_currentFrame{};
+  raw_frame_t m_previousFrame{};
+  qad_screen_buffer_t m_message{};
+  uint32_t m_sequence = 0;
+  uint32_t m_lastAcked = 0;
+  int m_framesSinceKeyframe = 0;
+  bool m_keyframeRequested = true;
+  bool m_writing = false;
+  bool m_closed = false;
+
+  void on_accepted(beast::error_code ec);
+  void read_client_message();
+  void on_client_message(beast::error_code ec);
+  void schedule_next_frame();
+  void on_timer_expired(beast::error_code ec);
+  void on_frame_built(bool failed, bool built, bool is_keyframe);
+  void on_frame_written(beast::error_code ec);
+  // runs on a worker, must only touch the frames, the message and
+  // m_framesSinceKeyframe
+  bool build_frame_message(bool keyframe_requested, uint32_t sequence,
+                           bool &is_keyframe);
+  void close_stream();
+
+public:
+  websocket_session_t(beast::tcp_stream &&stream, base_screen_t *screen,
+                      int screen_id, websocket_stream_options_t options);
+  ~websocket_session_t();
+  void run(http::request<http::string_body> const &request);
+};
+} // namespace qadx
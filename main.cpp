@@ -23,9 +23,14 @@
  * SOFTWARE.
  */
 
+#include "buffer_pool.hpp"
+#include "frame_capture.hpp"
+#include "network_session.hpp"
 #include "server.hpp"
 #include "string_utils.hpp"
+#include "vnc_server.hpp"
 #include <CLI/CLI11.hpp>
+#include <cstdio>
 #include <thread>
 
 namespace qadx {
@@ -33,27 +38,86 @@ runtime_args_t create_backend_runtime_args(cli_args_t &&cli_args) {
   utils::to_lower_string(cli_args.input_type);
   utils::to_lower_string(cli_args.screen_backend);
 
-  // expect screen_backend to be in ["kms", "ilm"]
-  if (!utils::expect_any_of(cli_args.screen_backend, "kms", "ilm"))
+  // expect screen_backend to be in ["kms", "ilm", "synthetic", "screencopy"]
+  if (!utils::expect_any_of(cli_args.screen_backend, "kms", "ilm",
+                            "synthetic", "screencopy"))
     throw std::runtime_error("invalid screen backend selected");
 
-  // expects input_type to be any of ["uinput", "evdev"]
-  if (!utils::expect_any_of(cli_args.input_type, "uinput", "evdev"))
+  // expects input_type to be any of ["uinput", "evdev", "record"]
+  if (!utils::expect_any_of(cli_args.input_type, "uinput", "evdev", "record"))
     throw std::runtime_error("invalid input type given");
 
   runtime_args_t args{};
   if (cli_args.input_type == "uinput")
     args.input_backend = input_type_e::uinput;
+  else if (cli_args.input_type == "record")
+    args.input_backend = input_type_e::record;
   else
     args.input_backend = input_type_e::evdev;
+  args.input_record = std::move(cli_args.input_record);
 
   if (cli_args.screen_backend == "kms") {
     args.screen_backend = screen_type_e::kms;
     args.kms_format_rgb = cli_args.kms_format_rgb;
+  } else if (cli_args.screen_backend == "synthetic") {
+    args.screen_backend = screen_type_e::synthetic;
+    auto &synthetic = args.synthetic;
+    synthetic.source = std::move(cli_args.synthetic_source);
+    if (sscanf(cli_args.synthetic_size.c_str(), "%dx%d", &synthetic.width,
+               &synthetic.height) != 2 ||
+        synthetic.width < 2 || synthetic.height < 2) {
+      throw std::runtime_error("--synthetic-size must be WIDTHxHEIGHT");
+    }
+    auto const &format = cli_args.synthetic_format;
+    if (format.size() != 4)
+      throw std::runtime_error("--synthetic-format must be a DRM fourcc");
+    synthetic.format = (uint32_t)format[0] | ((uint32_t)format[1] << 8) |
+                       ((uint32_t)format[2] << 16) |
+                       ((uint32_t)format[3] << 24);
+    if (cli_args.synthetic_fps < 1 || cli_args.synthetic_fps > 240)
+      throw std::runtime_error("--synthetic-fps must be within [1, 240]");
+    if (cli_args.synthetic_screens < 1 || cli_args.synthetic_screens > 16)
+      throw std::runtime_error("--synthetic-screens must be within [1, 16]");
+    synthetic.fps = cli_args.synthetic_fps;
+    synthetic.screens = cli_args.synthetic_screens;
+  } else if (cli_args.screen_backend == "screencopy") {
+    args.screen_backend = screen_type_e::screencopy;
   } else {
     args.screen_backend = screen_type_e::ilm;
   }
+  if (cli_args.vnc_port != 0) {
+    if (cli_args.vnc_screen < 0)
+      throw std::runtime_error("--vnc-screen is required by the VNC server");
+    if (cli_args.vnc_fps < 1 || cli_args.vnc_fps > 60)
+      throw std::runtime_error("--vnc-fps must be within [1, 60]");
+  }
+  if (cli_args.capture_fps < 0 || cli_args.capture_fps > 60)
+    throw std::runtime_error("--capture-fps must be within [0, 60]");
+  if (cli_args.capture_ring_size < 2)
+    throw std::runtime_error("--capture-ring-size must be at least 2");
+  // --capture-fps on its own keeps meaning a periodic capture
+  if (cli_args.capture_policy.empty()) {
+    args.capture_policy = cli_args.capture_fps != 0
+                              ? capture_policy_e::periodic
+                              : capture_policy_e::on_demand;
+  } else if (auto const policy = to_capture_policy(cli_args.capture_policy);
+             policy) {
+    args.capture_policy = *policy;
+  } else {
+    throw std::runtime_error("invalid capture policy given");
+  }
   args.port = cli_args.port;
+  if (cli_args.capture_fps != 0)
+    args.capture_fps = cli_args.capture_fps;
+  args.capture_ring_size = cli_args.capture_ring_size;
+  args.huge_pages = cli_args.huge_pages;
+  args.recording_dir = std::move(cli_args.recording_dir);
+  args.archive_dir = std::move(cli_args.archive_dir);
+  args.vnc_port = cli_args.vnc_port;
+  args.vnc_screen = cli_args.vnc_screen;
+  args.vnc_fps = cli_args.vnc_fps;
+  args.vnc_pointer_event = cli_args.vnc_pointer_event;
+  args.vnc_keyboard_event = cli_args.vnc_keyboard_event;
   return args;
 }
 } // namespace qadx
@@ -74,13 +138,59 @@ int main(int argc, char **argv) {
   cli_parser.add_option("-p,--port", args.port,
                         "port to bind server to(default: 3465)");
   cli_parser.add_option("-i,--input-type", args.input_type,
-                        "uinput or evdev; defaults to uinput");
+                        "uinput, evdev or record; defaults to uinput");
   cli_parser.add_option("-s,--screen-backend", args.screen_backend,
-                        "kms or ilm; defaults to kms");
+                        "kms, ilm, synthetic or screencopy; defaults to kms");
   cli_parser.add_option("-k,--kms-backend-card", kms_backend_card,
                         "set DRM device; defaults to 'card0'");
   cli_parser.add_flag("-r,--kms-format-rgb", args.kms_format_rgb,
                       "use RGB pixel format instead of BGR");
+  cli_parser.add_option("--vnc-port", args.vnc_port,
+                        "serve the screen over VNC on this port(default: off)");
+  cli_parser.add_option("--vnc-screen", args.vnc_screen,
+                        "screen ID served over VNC");
+  cli_parser.add_option("--vnc-fps", args.vnc_fps,
+                        "VNC framebuffer polling rate(default: 10)");
+  cli_parser.add_option("--vnc-pointer-event", args.vnc_pointer_event,
+                        "input event receiving VNC pointer events(default: 2)");
+  cli_parser.add_option("--vnc-keyboard-event", args.vnc_keyboard_event,
+                        "input event receiving VNC key events(default: 1)");
+  cli_parser.add_option("--capture-policy", args.capture_policy,
+                        "on-demand, periodic or change-triggered; how screens "
+                        "are captured unless changed at runtime"
+                        "(default: on-demand)");
+  cli_parser.add_option("--capture-fps", args.capture_fps,
+                        "rate of periodic captures and of checks for new "
+                        "frames, implies --capture-policy=periodic"
+                        "(default: 10)");
+  cli_parser.add_option("--capture-ring-size", args.capture_ring_size,
+                        "frames kept per background captured screen"
+                        "(default: 8)");
+  cli_parser.add_flag("--huge-pages", args.huge_pages,
+                      "advise transparent huge pages for image buffers");
+  cli_parser.add_option("--recording-dir", args.recording_dir,
+                        "directory screen recordings are written to"
+                        "(default: the temp directory)");
+  cli_parser.add_option("--archive-dir", args.archive_dir,
+                        "keep every distinct screenshot in this directory, "
+                        "served by /frames/{id}(default: off)");
+  cli_parser.add_option("--input-record", args.input_record,
+                        "file or FIFO the record input backend writes its "
+                        "events to(default: memory, served by /input/events)");
+  cli_parser.add_option("--synthetic-source", args.synthetic_source,
+                        "frames of the synthetic backend: pattern, a PNG file, "
+                        "a directory of PNG files or a file of raw "
+                        "frames(default: pattern)");
+  cli_parser.add_option("--synthetic-size", args.synthetic_size,
+                        "resolution of the synthetic screens(default: "
+                        "1280x720)");
+  cli_parser.add_option("--synthetic-format", args.synthetic_format,
+                        "DRM fourcc the synthetic frames are stored in: XR24, "
+                        "XB24, RG16, XR30 or NV12(default: XR24)");
+  cli_parser.add_option("--synthetic-fps", args.synthetic_fps,
+                        "rate the synthetic frames change at(default: 30)");
+  cli_parser.add_option("--synthetic-screens", args.synthetic_screens,
+                        "number of synthetic screens(default: 1)");
   cli_parser.set_version_flag("-v,--version", QAD_VERSION);
   CLI11_PARSE(cli_parser, argc, argv)
 
@@ -98,7 +208,20 @@ int main(int argc, char **argv) {
     }
   }
 
+  qadx::buffer_pool_t::use_huge_pages(rt_args.huge_pages != 0);
+  // the server only starts listening once the backends are up, /ready then
+  // tells whether both of them made it
+  qadx::warm_up_backends(rt_args);
+
   auto &io_context = qadx::get_io_context();
+  std::shared_ptr<qadx::vnc_server_t> vnc_server = nullptr;
+  if (rt_args.vnc_port != 0) {
+    vnc_server = std::make_shared<qadx::vnc_server_t>(io_context, rt_args);
+    if (!(*vnc_server))
+      return EXIT_FAILURE;
+    vnc_server->run();
+  }
+
   auto server_instance =
       std::make_shared<qadx::server_t>(io_context, std::move(rt_args));
   if (!(*server_instance))
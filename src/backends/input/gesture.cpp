@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "backends/input/gesture.hpp"
+#include <algorithm>
+#include <boost/asio/steady_timer.hpp>
+#include <memory>
+#include <spdlog/spdlog.h>
+
+namespace qadx {
+using namespace std::chrono_literals;
+
+namespace {
+class gesture_player_t
+    : public std::enable_shared_from_this<gesture_player_t> {
+  net::steady_timer m_timer;
+  base_input_t *const m_input;
+  int const m_event;
+  gesture_t m_gesture;
+  gesture_step_t m_step{};
+  gesture_callback_t m_callback;
+
+public:
+  gesture_player_t(net::io_context &io_context, base_input_t *input,
+                   int const event, gesture_t gesture,
+                   gesture_callback_t callback)
+      : m_timer{io_context}, m_input{input}, m_event{event},
+        m_gesture{std::move(gesture)}, m_callback{std::move(callback)} {}
+
+  void play_next() {
+    m_step = gesture_step_t{};
+    if (!m_gesture(m_step))
+      return m_callback(true);
+
+    m_timer.expires_after(m_step.delay);
+    m_timer.async_wait([self = shared_from_this()](auto const ec) {
+      if (ec)
+        return self->m_callback(false);
+      if (!self->send(self->m_step.frame))
+        return self->m_callback(false);
+      self->play_next();
+    });
+  }
+
+private:
+  bool send(utils::event_frame_t &frame) {
+    // backends throw for devices they don't know, which mustn't escape
+    // into the io_context
+    try {
+      return m_input->send_frame(frame, m_event);
+    } catch (std::exception const &e) {
+      spdlog::error("unable to send to device {}: {}", m_event, e.what());
+      return false;
+    }
+  }
+};
+} // namespace
+
+gesture_t touch_gesture(int const x, int const y, int const duration_s) {
+  return [=, next = 0](gesture_step_t &step) mutable {
+    switch (next++) {
+    case 0:
+      utils::add_tracking_event(step.frame, 100);
+      utils::add_position_event_mt(step.frame, x, y);
+      utils::add_button_event(step.frame, BUTTON_DOWN);
+      utils::add_position_event_abs(step.frame, x, y);
+      return true;
+    case 1:
+      step.delay = std::chrono::seconds(std::max(duration_s, 0));
+      utils::add_tracking_event(step.frame, -1);
+      utils::add_button_event(step.frame, BUTTON_UP);
+      return true;
+    default:
+      return false;
+    }
+  };
+}
+
+gesture_t swipe_gesture(int const x, int const y, int const x2, int const y2,
+                        int const steps) {
+  int const steps_y = (y - y2) / steps * -1;
+  int const steps_x = (x - x2) / steps * -1;
+  int const pressure = 50;
+  int const tracking_event = 100;
+  // the touch moves a step every half a second
+  auto const step_delay = 500ms;
+
+  // the touch goes down, moves `steps` times, reaches x2, y2 and goes up
+  return [=, next = 0](gesture_step_t &step) mutable {
+    int const index = next++;
+    // the touch major grows by one a frame while the finger is down
+    if (index == 0) {
+      utils::add_major_event(step.frame, 2);
+      utils::add_pressure_event(step.frame, pressure);
+      utils::add_position_event_mt(step.frame, x, y);
+      utils::add_tracking_event(step.frame, tracking_event);
+      utils::add_button_event(step.frame, BUTTON_DOWN);
+    } else if (index <= steps) {
+      // the first move goes with the touch down
+      step.delay = index == 1 ? 0ms : step_delay;
+      utils::add_major_event(step.frame, index + 1);
+      utils::add_pressure_event(step.frame, pressure);
+      utils::add_tracking_event(step.frame, tracking_event);
+      utils::add_position_event_mt(step.frame, x + steps_x * (index - 1),
+                                   y + steps_y * (index - 1));
+    } else if (index == steps + 1) {
+      step.delay = step_delay;
+      utils::add_major_event(step.frame, index + 1);
+      utils::add_pressure_event(step.frame, pressure);
+      utils::add_position_event_mt(step.frame, x2, y2);
+    } else if (index == steps + 2) {
+      utils::add_major_event(step.frame, 0);
+      utils::add_pressure_event(step.frame, 0);
+      utils::add_tracking_event(step.frame, -1);
+      utils::add_button_event(step.frame, BUTTON_UP);
+    } else {
+      return false;
+    }
+    return true;
+  };
+}
+
+gesture_t text_gesture(std::vector<int> const &key_codes) {
+  return [key_codes, next = std::size_t{0}](gesture_step_t &step) mutable {
+    if (next == key_codes.size())
+      return false;
+    // a key a second, for the slowest of text fields
+    step.delay = next == 0 ? 0ms : 1000ms;
+    step.frame.add(EV_KEY, key_codes[next], 1).add(EV_KEY, key_codes[next], 0);
+    ++next;
+    return true;
+  };
+}
+
+void play_gesture(net::io_context &io_context, base_input_t *input,
+                  int const event, gesture_t gesture,
+                  gesture_callback_t callback) {
+  std::make_shared<gesture_player_t>(io_context, input, event,
+                                     std::move(gesture), std::move(callback))
+      ->play_next();
+}
+} // namespace qadx
@@ -0,0 +1,237 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "backends/input/record.hpp"
+#include "backends/input/common.hpp"
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <spdlog/spdlog.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace qadx {
+namespace {
+// records kept by the ring before the oldest ones are dropped
+constexpr std::size_t ring_capacity = 65536;
+// FIFO writes up to PIPE_BUF are atomic, so a full FIFO never gets half a
+// record
+constexpr std::size_t records_per_write = 4096 / sizeof(input_record_t);
+// each device holds a pipe, so only as many as an evdev setup would have
+constexpr int max_devices = 32;
+} // namespace
+
+std::unique_ptr<record_backend_t> create_instance(std::string const &sink) {
+  std::unique_ptr<record_backend_t> backend(new record_backend_t());
+  if (!sink.empty()) {
+    // a FIFO nobody reads from mustn't stall the devices, so it's opened
+    // non-blocking and records that don't fit are dropped
+    struct stat sink_stat {};
+    if (stat(sink.c_str(), &sink_stat) == 0 && S_ISFIFO(sink_stat.st_mode))
+      backend->m_sink = open(sink.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    else
+      backend->m_sink = open(sink.c_str(),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (backend->m_sink < 0) {
+      throw std::runtime_error("unable to open " + sink + ": " +
+                               strerror(errno));
+    }
+  }
+  backend->m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (backend->m_wakeFd < 0)
+    throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+  backend->m_drainThread = std::thread([raw = backend.get()] { raw->drain(); });
+  return backend;
+}
+
+record_backend_t *
+record_backend_t::create_global_instance(std::string const &sink) {
+  static auto instance = create_instance(sink);
+  return instance.get();
+}
+
+record_backend_t::~record_backend_t() {
+  m_running = false;
+  uint64_t const wake = 1;
+  if (write(m_wakeFd, &wake, sizeof wake) < 0)
+    spdlog::error("unable to stop the input recorder: {}", strerror(errno));
+  if (m_drainThread.joinable())
+    m_drainThread.join();
+  collect();
+  for (auto const &[event, device] : m_devices) {
+    close(device.read_fd);
+    close(device.write_fd);
+  }
+  close(m_wakeFd);
+  if (m_sink >= 0)
+    close(m_sink);
+}
+
+int record_backend_t::device_fd(int const event) {
+  if (event < 0 || event >= max_devices)
+    throw std::runtime_error("event not found");
+
+  std::lock_guard lock{m_mutex};
+  if (auto iter = m_devices.find(event); iter != m_devices.end())
+    return iter->second.write_fd;
+
+  int pipe_fds[2]{};
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    spdlog::error("unable to create input device {}: {}", event,
+                  strerror(errno));
+    return -1;
+  }
+  fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+  auto &device = m_devices[event];
+  device.read_fd = pipe_fds[0];
+  device.write_fd = pipe_fds[1];
+  // the drain thread polls the new pipe from now on
+  uint64_t const wake = 1;
+  if (write(m_wakeFd, &wake, sizeof wake) < 0)
+    spdlog::error("unable to wake the input recorder: {}", strerror(errno));
+  return device.write_fd;
+}
+
+void record_backend_t::drain() {
+  std::vector<pollfd> poll_fds{};
+  while (m_running) {
+    poll_fds.assign(1, pollfd{m_wakeFd, POLLIN, 0});
+    {
+      std::lock_guard lock{m_mutex};
+      for (auto const &[event, device] : m_devices)
+        poll_fds.push_back(pollfd{device.read_fd, POLLIN, 0});
+    }
+    if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      spdlog::error("input recorder stopped: {}", strerror(errno));
+      return;
+    }
+    if (poll_fds[0].revents & POLLIN) {
+      uint64_t wake = 0;
+      if (read(m_wakeFd, &wake, sizeof wake) < 0 && errno != EAGAIN)
+        spdlog::error("input recorder: {}", strerror(errno));
+    }
+    collect();
+  }
+}
+
+// moves whatever the devices have written so far to the sink or the ring
+void record_backend_t::collect() {
+  std::lock_guard lock{m_mutex};
+  char buffer[sizeof(input_event) * 256];
+  std::vector<input_record_t> records{};
+  for (auto &[event, device] : m_devices) {
+    ssize_t bytes_read = 0;
+    while ((bytes_read = read(device.read_fd, buffer, sizeof buffer)) > 0) {
+      auto &pending = device.pending;
+      pending.insert(pending.end(), buffer, buffer + bytes_read);
+      auto const count = pending.size() / sizeof(input_event);
+      records.resize(count);
+      for (std::size_t i = 0; i < count; ++i) {
+        input_event input{};
+        memcpy(&input, pending.data() + i * sizeof(input_event),
+               sizeof(input_event));
+        auto &record = records[i];
+        record.timestamp_us =
+            (int64_t)input.input_event_sec * 1'000'000 + input.input_event_usec;
+        record.device = event;
+        record.type = input.type;
+        record.code = input.code;
+        record.value = input.value;
+        record.reserved = 0;
+      }
+      pending.erase(pending.begin(),
+                    pending.begin() + (long)(count * sizeof(input_event)));
+      store(records.data(), records.size());
+    }
+  }
+}
+
+void record_backend_t::store(input_record_t const *records,
+                             std::size_t const count) {
+  if (m_sink < 0) {
+    for (std::size_t i = 0; i < count; ++i) {
+      if (m_ring.size() == ring_capacity) {
+        m_ring.pop_front();
+        ++m_dropped;
+      }
+      m_ring.push_back(records[i]);
+    }
+    return;
+  }
+
+  for (std::size_t i = 0; i < count; i += records_per_write) {
+    auto const chunk = std::min(records_per_write, count - i);
+    if (write(m_sink, records + i, chunk * sizeof(input_record_t)) < 0) {
+      if (errno != EAGAIN)
+        spdlog::error("unable to record input events: {}", strerror(errno));
+      m_dropped += chunk;
+    }
+  }
+}
+
+std::vector<input_record_t>
+record_backend_t::recorded_events(uint64_t &dropped) {
+  // whatever a finished request wrote is still in its pipe until collected
+  collect();
+  std::lock_guard lock{m_mutex};
+  dropped = m_dropped;
+  return {m_ring.begin(), m_ring.end()};
+}
+
+void record_backend_t::clear() {
+  collect();
+  std::lock_guard lock{m_mutex};
+  m_ring.clear();
+  m_dropped = 0;
+}
+
+bool record_backend_t::move(int const x_axis, int const y_axis,
+                            int const event) {
+  int const fd = device_fd(event);
+  return fd >= 0 && utils::send_move(x_axis, y_axis, fd);
+}
+
+bool record_backend_t::button(int const value, int const event) {
+  int const fd = device_fd(event);
+  return fd >= 0 && utils::send_button(value, fd);
+}
+
+bool record_backend_t::key(int const key, int const event) {
+  int const fd = device_fd(event);
+  return fd >= 0 && utils::send_key(key, fd);
+}
+
+bool record_backend_t::send_frame(utils::event_frame_t &frame,
+                                  int const event) {
+  int const fd = device_fd(event);
+  return fd >= 0 && frame.submit(fd);
+}
+} // namespace qadx
@@ -25,8 +25,12 @@
 
 #include "backends/screen/ilm.hpp"
 #include "image.hpp"
-#include <netinet/in.h>
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <future>
+#include <poll.h>
 #include <spdlog/spdlog.h>
+#include <sys/eventfd.h>
 
 namespace qadx {
 void wm_screen_listener_screen_id(void *data, struct ivi_wm_screen *,
@@ -35,7 +39,14 @@ void wm_screen_listener_screen_id(void *data, struct ivi_wm_screen *,
   output_screen->screen_id = static_cast<int>(screen_id);
 }
 
-void wm_screen_listener_layer_added(void *, ivi_wm_screen *, uint32_t) {}
+// render orders are sent as a list of additions, after asking for them
+void wm_screen_listener_layer_added(void *data, ivi_wm_screen *,
+                                    uint32_t const layer_id) {
+  auto output_screen = reinterpret_cast<wayland_screen_t *>(data);
+  auto &layers = output_screen->scene->screen_layers[output_screen->screen_id];
+  if (std::find(layers.begin(), layers.end(), layer_id) == layers.end())
+    layers.push_back(layer_id);
+}
 void wm_screen_listener_connector_name(void *, ivi_wm_screen *, char const *) {}
 void wm_screen_listener_error(void *, ivi_wm_screen *, uint32_t, char const *) {
 }
@@ -77,12 +88,171 @@ ivi_wm_screen_listener const wm_screen_listener = {
     wm_screen_listener_error,
 };
 
-void registry_remover(void *, wl_registry *, uint32_t) {}
+namespace {
+wayland_data_t &wayland_data_of(void *data) {
+  return *reinterpret_cast<wayland_data_t *>(data);
+}
+
+// asks every screen and layer for its render order again, the scene graph
+// is only told about additions
+void refresh_render_orders(wayland_data_t &wd) {
+  wd.scene.screen_layers.clear();
+  wayland_screen_t *output = nullptr;
+  wl_list_for_each(output, &wd.output_list, wy_link) {
+    if (output->wm_screen)
+      ivi_wm_screen_get(output->wm_screen, IVI_WM_PARAM_RENDER_ORDER);
+  }
+  for (auto &[layer_id, layer] : wd.scene.layers) {
+    layer.surfaces.clear();
+    ivi_wm_layer_get(wd.wm, layer_id, IVI_WM_PARAM_RENDER_ORDER);
+  }
+}
+} // namespace
+
+void wm_surface_visibility(void *data, ivi_wm *, uint32_t const surface_id,
+                           int32_t const visibility) {
+  wayland_data_of(data).scene.surfaces[surface_id].visible = visibility != 0;
+}
+
+void wm_layer_visibility(void *data, ivi_wm *, uint32_t const layer_id,
+                         int32_t const visibility) {
+  wayland_data_of(data).scene.layers[layer_id].visible = visibility != 0;
+}
+
+void wm_surface_opacity(void *, ivi_wm *, uint32_t, wl_fixed_t) {}
+void wm_layer_opacity(void *, ivi_wm *, uint32_t, wl_fixed_t) {}
+void wm_surface_source_rectangle(void *, ivi_wm *, uint32_t, int32_t, int32_t,
+                                 int32_t, int32_t) {}
+void wm_layer_source_rectangle(void *, ivi_wm *, uint32_t, int32_t, int32_t,
+                               int32_t, int32_t) {}
+
+void wm_surface_destination_rectangle(void *data, ivi_wm *,
+                                      uint32_t const surface_id,
+                                      int32_t const x, int32_t const y,
+                                      int32_t const width,
+                                      int32_t const height) {
+  wayland_data_of(data).scene.surfaces[surface_id].destination = {
+      x, y, width, height};
+}
+
+void wm_layer_destination_rectangle(void *data, ivi_wm *,
+                                    uint32_t const layer_id, int32_t const x,
+                                    int32_t const y, int32_t const width,
+                                    int32_t const height) {
+  wayland_data_of(data).scene.layers[layer_id].destination = {x, y, width,
+                                                              height};
+}
+
+void wm_surface_created(void *data, ivi_wm *wm, uint32_t const surface_id) {
+  auto &wd = wayland_data_of(data);
+  wd.scene.surfaces.try_emplace(surface_id);
+  // properties are only sent for the surfaces we sync with
+  ivi_wm_surface_sync(wm, surface_id, IVI_WM_SYNC_ADD);
+  ivi_wm_surface_get(wm, surface_id,
+                     IVI_WM_PARAM_SIZE | IVI_WM_PARAM_VISIBILITY);
+  refresh_render_orders(wd);
+}
+
+void wm_layer_created(void *data, ivi_wm *wm, uint32_t const layer_id) {
+  auto &wd = wayland_data_of(data);
+  wd.scene.layers.try_emplace(layer_id);
+  ivi_wm_layer_sync(wm, layer_id, IVI_WM_SYNC_ADD);
+  ivi_wm_layer_get(wm, layer_id, IVI_WM_PARAM_VISIBILITY);
+  refresh_render_orders(wd);
+}
+
+void wm_surface_destroyed(void *data, ivi_wm *, uint32_t const surface_id) {
+  auto &scene = wayland_data_of(data).scene;
+  scene.surfaces.erase(surface_id);
+  for (auto &[layer_id, layer] : scene.layers) {
+    auto &surfaces = layer.surfaces;
+    surfaces.erase(std::remove(surfaces.begin(), surfaces.end(), surface_id),
+                   surfaces.end());
+  }
+}
+
+void wm_layer_destroyed(void *data, ivi_wm *, uint32_t const layer_id) {
+  auto &scene = wayland_data_of(data).scene;
+  scene.layers.erase(layer_id);
+  for (auto &[screen_id, layers] : scene.screen_layers) {
+    layers.erase(std::remove(layers.begin(), layers.end(), layer_id),
+                 layers.end());
+  }
+}
+
+void wm_surface_error(void *, ivi_wm *, uint32_t const object_id,
+                      uint32_t const error, char const *message) {
+  spdlog::error("ivi surface {}, error {}: {}", object_id, error, message);
+}
+
+void wm_layer_error(void *, ivi_wm *, uint32_t const object_id,
+                    uint32_t const error, char const *message) {
+  spdlog::error("ivi layer {}, error {}: {}", object_id, error, message);
+}
+
+void wm_surface_size(void *data, ivi_wm *, uint32_t const surface_id,
+                     int32_t const width, int32_t const height) {
+  auto &surface = wayland_data_of(data).scene.surfaces[surface_id];
+  surface.width = width;
+  surface.height = height;
+}
+
+void wm_surface_stats(void *, ivi_wm *, uint32_t, uint32_t, uint32_t) {}
+
+void wm_layer_surface_added(void *data, ivi_wm *, uint32_t const layer_id,
+                            uint32_t const surface_id) {
+  auto &surfaces = wayland_data_of(data).scene.layers[layer_id].surfaces;
+  if (std::find(surfaces.begin(), surfaces.end(), surface_id) ==
+      surfaces.end())
+    surfaces.push_back(surface_id);
+}
+
+ivi_wm_listener const wm_listener = {
+    wm_surface_visibility,
+    wm_layer_visibility,
+    wm_surface_opacity,
+    wm_layer_opacity,
+    wm_surface_source_rectangle,
+    wm_layer_source_rectangle,
+    wm_surface_destination_rectangle,
+    wm_layer_destination_rectangle,
+    wm_surface_created,
+    wm_layer_created,
+    wm_surface_destroyed,
+    wm_layer_destroyed,
+    wm_surface_error,
+    wm_layer_error,
+    wm_surface_size,
+    wm_surface_stats,
+    wm_layer_surface_added,
+};
+
+// outputs come and go with the displays plugged in
+void registry_remover(void *data, wl_registry *, uint32_t const name) {
+  auto &wd = wayland_data_of(data);
+  wayland_screen_t *output = nullptr;
+  wayland_screen_t *next = nullptr;
+  wl_list_for_each_safe(output, next, &wd.output_list, wy_link) {
+    if (output->global_name != name)
+      continue;
+    spdlog::info("Screen {} removed", output->screen_id);
+    wd.scene.screen_layers.erase(output->screen_id);
+    wl_list_remove(&output->wy_link);
+    if (output->wm_screen)
+      ivi_wm_screen_destroy(output->wm_screen);
+    wl_output_destroy(output->output);
+    delete output;
+    return;
+  }
+}
+
 void registry_handler(void *data, wl_registry *registry, uint32_t const id,
                       char const *interface, uint32_t const) {
   auto wd = reinterpret_cast<wayland_data_t *>(data);
   if (interface == std::string("wl_output")) {
     auto output_screen = new wayland_screen_t();
+    output_screen->scene = &wd->scene;
+    output_screen->global_name = id;
     output_screen->output = reinterpret_cast<wl_output *>(
         wl_registry_bind(registry, id, &wl_output_interface, 1));
 
@@ -93,11 +263,14 @@ void registry_handler(void *data, wl_registry *registry, uint32_t const id,
           ivi_wm_create_screen(wd->wm, output_screen->output);
       ivi_wm_screen_add_listener(output_screen->wm_screen, &wm_screen_listener,
                                  output_screen);
+      // the screen id is sent first, on creation
+      ivi_wm_screen_get(output_screen->wm_screen, IVI_WM_PARAM_RENDER_ORDER);
     }
     wl_list_insert(&wd->output_list, &output_screen->wy_link);
   } else if (interface == std::string("ivi_wm")) {
     auto r = wl_registry_bind(registry, id, &ivi_wm_interface, 1);
     wd->wm = reinterpret_cast<ivi_wm *>(r);
+    ivi_wm_add_listener(wd->wm, &wm_listener, wd);
   }
 }
 
@@ -107,8 +280,11 @@ static wl_registry_listener const registry_listener = {
 };
 
 std::unique_ptr<ilm_screen_t> create_instance() {
-  wayland_data_t wd{};
+  // the listeners keep pointers into wayland_data, so it's set up in place
+  std::unique_ptr<ilm_screen_t> screen(new ilm_screen_t());
+  auto &wd = screen->wayland_data;
 
+  wl_list_init(&wd.output_list);
   wd.display = wl_display_connect(nullptr);
   if (!wd.display) {
     spdlog::error("failed to connect to WL display: {}", strerror(errno));
@@ -116,7 +292,6 @@ std::unique_ptr<ilm_screen_t> create_instance() {
   }
 
   wd.queue = wl_display_create_queue(wd.display);
-  wl_list_init(&wd.output_list);
   wd.registry = wl_display_get_registry(wd.display);
   wl_proxy_set_queue((wl_proxy *)wd.registry, wd.queue);
   wl_registry_add_listener(wd.registry, &registry_listener, &wd);
@@ -129,7 +304,6 @@ std::unique_ptr<ilm_screen_t> create_instance() {
 
   if (!wd.wm) {
     spdlog::error("Compositor does not ivi_wm or weston screenshoter");
-    wl_display_disconnect(wd.display);
     return nullptr;
   }
 
@@ -144,12 +318,26 @@ std::unique_ptr<ilm_screen_t> create_instance() {
 
   // Block until all pending request are processed by the server
   if (wl_display_roundtrip_queue(wd.display, wd.queue) == -1) {
-    // do error check and free resources
     spdlog::error("setting ivi_wm_screen listeners failed");
-    wl_display_disconnect(wd.display);
     return nullptr;
   }
-  return std::unique_ptr<ilm_screen_t>(new ilm_screen_t(std::move(wd)));
+  // the screen ids are known now, so are the layers they show
+  refresh_render_orders(wd);
+  if (wl_display_roundtrip_queue(wd.display, wd.queue) == -1) {
+    spdlog::error("getting the ivi scene graph failed");
+    return nullptr;
+  }
+
+  screen->m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (screen->m_wakeFd < 0) {
+    spdlog::error("unable to create the Wayland thread: {}", strerror(errno));
+    return nullptr;
+  }
+  screen->m_running = true;
+  screen->m_dispatchThread = std::thread([raw = screen.get()] {
+    raw->dispatch();
+  });
+  return screen;
 }
 
 ilm_screen_t *ilm_screen_t::create_global_instance() {
@@ -157,6 +345,30 @@ ilm_screen_t *ilm_screen_t::create_global_instance() {
   return instance.get();
 }
 
+namespace {
+// BMP rows go bottom-up in B, G, R, A order (B at the lowest address),
+// which is how ARGB8888 and XRGB8888 are laid out already
+void write_bmp_rows(unsigned char const *in, int const in_stride,
+                    int const width, int const height, bool const rgb,
+                    unsigned char *out) {
+  auto const out_stride = (size_t)width * 4;
+  for (int row = 0; row < height; ++row, out += out_stride) {
+    auto const *pixel = in + (size_t)(height - row - 1) * in_stride;
+    if (!rgb) {
+      memcpy(out, pixel, out_stride);
+      continue;
+    }
+    auto *out_pixel = out;
+    for (int col = 0; col < width; ++col, pixel += 4, out_pixel += 4) {
+      out_pixel[0] = pixel[2];
+      out_pixel[1] = pixel[1];
+      out_pixel[2] = pixel[0];
+      out_pixel[3] = pixel[3];
+    }
+  }
+}
+} // namespace
+
 void ivi_screenshot_done(void *data, ivi_screenshot *ivi_screenshot,
                          int32_t const fd, int32_t const width,
                          int32_t const height, int32_t const stride,
@@ -166,31 +378,21 @@ void ivi_screenshot_done(void *data, ivi_screenshot *ivi_screenshot,
   screen_shot->done = 1;
   ivi_screenshot_destroy(ivi_screenshot);
 
-  int flip_order;
-  int has_alpha;
-
+  // whether the pixels are R, G, B from the lowest address
+  bool rgb;
   switch (format) {
   case WL_SHM_FORMAT_ARGB8888:
-    flip_order = 1;
-    has_alpha = 1;
-    break;
   case WL_SHM_FORMAT_XRGB8888:
-    flip_order = 1;
-    has_alpha = 0;
+    rgb = false;
     break;
   case WL_SHM_FORMAT_ABGR8888:
-    flip_order = 0;
-    has_alpha = 1;
-    break;
   case WL_SHM_FORMAT_XBGR8888:
-    flip_order = 0;
-    has_alpha = 0;
+    rgb = true;
     break;
   default:
     return spdlog::error("unsupported pixel format {}", format);
   }
 
-  int const bytes_per_pixel = has_alpha ? 4 : 3;
   int32_t image_size = stride * height;
 
   auto raw_memory = mmap(nullptr, image_size, PROT_READ, MAP_SHARED, fd, 0);
@@ -202,27 +404,21 @@ void ivi_screenshot_done(void *data, ivi_screenshot *ivi_screenshot,
   if (buffer == MAP_FAILED)
     return spdlog::error("failed to mmap screen_shot file: {}", image_size);
 
-  screen_shot->data.resize(image_size);
-  if (screen_shot->data.empty()) {
-    return spdlog::error("failed to allocate %d bytes for image buffer: {}",
-                         image_size);
-  }
-
-  // Store the image in image_buffer in the following order B, G, R, [A](B at
-  // the lowest address)
-  for (int32_t row = 0; row < height; ++row) {
-    for (int32_t col = 0; col < width; ++col) {
-      int32_t const offset = (height - row - 1) * width + col;
-      uint32_t const pixel = htonl(((uint32_t *)buffer)[offset]);
-      auto pixel_p = (char *)&pixel;
-      int32_t const image_offset = row * stride + col * bytes_per_pixel;
-      for (int32_t i = 0; i < 3; ++i) {
-        int32_t j = flip_order ? 2 - i : i;
-        screen_shot->data[image_offset + i] = pixel_p[1 + j];
-      }
-      if (has_alpha)
-        screen_shot->data[image_offset + 3] = pixel_p[0];
-    }
+  if (auto raw_frame = screen_shot->raw_frame; raw_frame) {
+    ensure_buffer_size(raw_frame->data, image_size);
+    memcpy(raw_frame->data.data(), buffer, image_size);
+    raw_frame->width = width;
+    raw_frame->height = height;
+    raw_frame->stride = stride;
+    raw_frame->bpp = 32;
+    raw_frame->rgb = rgb;
+  } else if (auto image = screen_shot->image; image) {
+    // the same hash as the raw frame would have, which has the same layout
+    screen_shot->hash = hash_pixels(buffer, width, height, stride, 32, rgb);
+    write_bmp_rows(buffer, stride, width, height, rgb,
+                   begin_bmp(width, height, width * 4, *image));
+  } else {
+    return;
   }
   screen_shot->height = height;
   screen_shot->width = width;
@@ -242,48 +438,399 @@ ivi_screenshot_listener screenshot_listener = {
     ivi_screenshot_error,
 };
 
-bool ilm_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
-                                     int const screen) {
-  wayland_screen_t *chosen_screen = nullptr;
-  wayland_screen_t *output = nullptr;
+// called on the dispatch thread with m_mutex held
+void ilm_screen_t::request_screenshots(screenshot_batch_t &batch) {
+  auto &screen_shots = batch.screen_shots;
+  for (std::size_t i = 0; i < batch.screens.size(); ++i) {
+    auto &screen_shot = screen_shots[i];
+    if (batch.surfaces) {
+      auto const surface_id = static_cast<uint32_t>(batch.screens[i]);
+      auto surface_shot =
+          wayland_data.scene.surfaces.count(surface_id) != 0
+              ? ivi_wm_surface_screenshot(wayland_data.wm, surface_id)
+              : nullptr;
+      if (!surface_shot) {
+        spdlog::error("Failed to find surface with ID {}", surface_id);
+        screen_shot.done = 1;
+        continue;
+      }
+      ivi_screenshot_add_listener(surface_shot, &screenshot_listener,
+                                  &screen_shot);
+      batch.requested = true;
+      continue;
+    }
 
-  wl_list_for_each(output, &wayland_data.output_list, wy_link) {
-    if (output && screen == output->screen_id) {
-      chosen_screen = output;
+    wayland_screen_t *chosen_screen = nullptr;
+    wayland_screen_t *output = nullptr;
+
+    wl_list_for_each(output, &wayland_data.output_list, wy_link) {
+      if (output && batch.screens[i] == output->screen_id) {
+        chosen_screen = output;
+        break;
+      }
+    }
+
+    if (!chosen_screen) {
+      spdlog::error("Failed to find screen with ID {}", batch.screens[i]);
+      screen_shot.done = 1;
+      continue;
+    }
+
+    // Grab screenshot of individual screens
+    auto screen_shot_screen =
+        ivi_wm_screen_screenshot(chosen_screen->wm_screen);
+    if (!screen_shot_screen) {
+      screen_shot.done = 1;
+      continue;
+    }
+
+    ivi_screenshot_add_listener(screen_shot_screen, &screenshot_listener,
+                                &screen_shot);
+    batch.requested = true;
+  }
+}
+
+void ilm_screen_t::submit(std::unique_ptr<screenshot_batch_t> batch) {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (m_running) {
+      m_submitted.push_back(std::move(batch));
+      uint64_t const wake = 1;
+      if (write(m_wakeFd, &wake, sizeof wake) < 0)
+        spdlog::error("unable to wake the Wayland thread: {}", strerror(errno));
+      return;
+    }
+  }
+  // the connection to the compositor is gone
+  for (auto &screen_shot : batch->screen_shots)
+    screen_shot.done = 1;
+  batch->done(*batch);
+}
+
+// the only thread reading and dispatching the display's event queue. Every
+// batch submitted meanwhile is requested as soon as it arrives, so any
+// number of them can be waiting on the compositor at once
+void ilm_screen_t::dispatch() {
+  auto const display = wayland_data.display;
+  auto const queue = wayland_data.queue;
+  std::vector<std::unique_ptr<screenshot_batch_t>> in_flight{};
+  auto const complete_batches = [&in_flight] {
+    auto const is_done = [](auto const &batch) {
+      return std::all_of(batch->screen_shots.begin(),
+                         batch->screen_shots.end(),
+                         [](auto const &screen_shot) {
+                           return screen_shot.done != 0;
+                         });
+    };
+    for (auto iter = in_flight.begin(); iter != in_flight.end();) {
+      if (!is_done(*iter)) {
+        ++iter;
+        continue;
+      }
+      auto &batch = **iter;
+      batch.done(batch);
+      iter = in_flight.erase(iter);
+    }
+  };
+
+  while (m_running) {
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      for (auto &batch : m_submitted) {
+        request_screenshots(*batch);
+        in_flight.push_back(std::move(batch));
+      }
+      m_submitted.clear();
+      while (wl_display_prepare_read_queue(display, queue) != 0)
+        wl_display_dispatch_queue_pending(display, queue);
+    }
+    complete_batches();
+
+    pollfd poll_fds[2] = {{wl_display_get_fd(display), POLLIN, 0},
+                          {m_wakeFd, POLLIN, 0}};
+    if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+      wl_display_cancel_read(display);
+      spdlog::error("lost the Wayland display: {}", strerror(errno));
+      break;
+    }
+    if (poll(poll_fds, 2, -1) < 0) {
+      wl_display_cancel_read(display);
+      if (errno == EINTR)
+        continue;
+      spdlog::error("Wayland thread stopped: {}", strerror(errno));
       break;
     }
+
+    if (poll_fds[0].revents & POLLIN) {
+      if (wl_display_read_events(display) < 0) {
+        spdlog::error("lost the Wayland display: {}", strerror(errno));
+        break;
+      }
+    } else {
+      wl_display_cancel_read(display);
+    }
+    if (poll_fds[1].revents & POLLIN) {
+      uint64_t wake = 0;
+      if (read(m_wakeFd, &wake, sizeof wake) < 0 && errno != EAGAIN)
+        spdlog::error("Wayland thread: {}", strerror(errno));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      wl_display_dispatch_queue_pending(display, queue);
+    }
+    complete_batches();
   }
 
-  if (!chosen_screen) {
-    spdlog::error("Failed to find screen with ID {}", screen);
-    return false;
+  // nothing is going to complete the screenshots still waiting
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_running = false;
+    for (auto &batch : m_submitted)
+      in_flight.push_back(std::move(batch));
+    m_submitted.clear();
+  }
+  for (auto &batch : in_flight) {
+    for (auto &screen_shot : batch->screen_shots)
+      screen_shot.done = 1;
   }
+  complete_batches();
+}
 
-  // Grab screenshot of individual screens
-  auto screen_shot_screen = ivi_wm_screen_screenshot(chosen_screen->wm_screen);
-  if (!screen_shot_screen)
-    return false;
+bool ilm_screen_t::take_screenshots(std::vector<int> const &screens,
+                                    std::vector<screenshot_t> &screen_shots) {
+  // every screenshot is asked for before waiting on any of them, so the
+  // compositor takes them as close together as it can
+  auto batch = std::make_unique<screenshot_batch_t>();
+  batch->screens = screens;
+  batch->screen_shots = std::move(screen_shots);
+  std::promise<bool> completed{};
+  auto requested = completed.get_future();
+  batch->done = [&completed, &screen_shots](screenshot_batch_t &done_batch) {
+    screen_shots = std::move(done_batch.screen_shots);
+    completed.set_value(done_batch.requested);
+  };
+  submit(std::move(batch));
+  return requested.get();
+}
 
-  screenshot_t screen_shot{};
-  ivi_screenshot_add_listener(screen_shot_screen, &screenshot_listener,
-                              &screen_shot);
+bool ilm_screen_t::take_screenshot(screenshot_t &screen_shot,
+                                   int const screen) {
+  std::vector<screenshot_t> screen_shots(1);
+  screen_shots[0].raw_frame = screen_shot.raw_frame;
+  bool const taken = take_screenshots({screen}, screen_shots);
+  screen_shot = std::move(screen_shots[0]);
+  return taken;
+}
 
-  int ret;
-  do {
-    ret = wl_display_roundtrip_queue(wayland_data.display, wayland_data.queue);
-  } while ((ret != -1) && !screen_shot.done);
+// the outputs are kept up to date by the dispatch thread, so this never
+// waits on the compositor
+std::string ilm_screen_t::list_screens() {
+  std::vector<wayland_screen_t const *> outputs{};
+  std::lock_guard<std::mutex> lock{m_mutex};
+  wayland_screen_t *output = nullptr;
+  wl_list_for_each(output, &wayland_data.output_list, wy_link) {
+    if (output->wm_screen)
+      outputs.push_back(output);
+  }
+  std::sort(outputs.begin(), outputs.end(), [](auto const lhs, auto const rhs) {
+    return lhs->screen_id < rhs->screen_id;
+  });
+
+  std::string reply{};
+  for (auto const output_screen : outputs) {
+    reply += fmt::format("SCREEN: ID={}, size={}x{}, offset={},{}\n",
+                         output_screen->screen_id, output_screen->width,
+                         output_screen->height, output_screen->offset_x,
+                         output_screen->offset_y);
+  }
+  return reply;
+}
 
-  if (screen_shot.data.empty()) {
+std::vector<int> ilm_screen_t::screen_ids() {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  std::vector<int> ids{};
+  wayland_screen_t *output = nullptr;
+  wl_list_for_each(output, &wayland_data.output_list, wy_link) {
+    if (output->wm_screen)
+      ids.push_back(output->screen_id);
+  }
+  return ids;
+}
+
+bool ilm_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
+                                     int const screen) {
+  raw_frame_t frame{};
+  bool const grabbed = grab_raw_frame(frame, screen);
+  if (grabbed)
+    encode_raw_frame(frame, screen_buffer);
+  buffer_pool_t::instance().release(std::move(frame.data));
+  return grabbed;
+}
+
+bool ilm_screen_t::grab_raw_frame(raw_frame_t &frame, int const screen) {
+  screenshot_t screen_shot{};
+  screen_shot.raw_frame = &frame;
+  frame.data.clear();
+  if (!take_screenshot(screen_shot, screen))
+    return false;
+
+  if (frame.data.empty()) {
     spdlog::error("Error taking screenshot");
     return false;
   }
-
-  encode_bmp(screen_shot.data, screen_shot.width, screen_shot.height,
-             screen_shot.stride, screen_buffer);
   return true;
 }
 
+void ilm_screen_t::grab_raw_frames(std::vector<int> const &screens,
+                                   std::vector<raw_frame_t> &frames) {
+  frames.resize(screens.size());
+  std::vector<screenshot_t> screen_shots(screens.size());
+  for (std::size_t i = 0; i < screens.size(); ++i) {
+    frames[i].data.clear();
+    screen_shots[i].raw_frame = &frames[i];
+  }
+  take_screenshots(screens, screen_shots);
+}
+
+void ilm_screen_t::grab_raw_frames_async(std::vector<int> const &screens,
+                                         raw_frames_callback_t callback) {
+  submit_async(screens, false, std::move(callback));
+}
+
+void ilm_screen_t::grab_screenshot_async(int const screen,
+                                         screenshot_grab_callback_t callback) {
+  auto image = make_pooled_image();
+  auto batch = std::make_unique<screenshot_batch_t>();
+  batch->screens = {screen};
+  batch->screen_shots.resize(1);
+  batch->screen_shots[0].image = image.get();
+  batch->done = [this, image = std::move(image),
+                 callback = std::move(callback)](
+                    screenshot_batch_t &done_batch) mutable {
+    auto const &screen_shot = done_batch.screen_shots[0];
+    grabbed_screenshot_t grabbed{};
+    grabbed.captured = screen_shot.width != 0;
+    if (grabbed.captured) {
+      grabbed.hash = screen_shot.hash;
+      grabbed.image = std::move(image);
+    }
+    boost::asio::post(m_completions, [callback = std::move(callback),
+                                      grabbed = std::move(grabbed)]() mutable {
+      callback(std::move(grabbed));
+    });
+  };
+  submit(std::move(batch));
+}
+
+void ilm_screen_t::grab_surface_async(uint32_t const surface_id,
+                                      raw_frames_callback_t callback) {
+  submit_async({static_cast<int>(surface_id)}, true, std::move(callback));
+}
+
+void ilm_screen_t::grab_layer_async(uint32_t const layer_id,
+                                    raw_frames_callback_t callback) {
+  // ivi-wm only captures screens and surfaces: a layer showing a single
+  // surface is that surface, anything else is cut out of its screen
+  std::optional<int> screen_id{};
+  ivi_rectangle_t area{};
+  uint32_t surface_id = 0;
+  std::size_t surface_count = 0;
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto const &scene = wayland_data.scene;
+    if (auto iter = scene.layers.find(layer_id); iter != scene.layers.end()) {
+      area = iter->second.destination;
+      surface_count = iter->second.surfaces.size();
+      if (surface_count == 1)
+        surface_id = iter->second.surfaces[0];
+    }
+    for (auto const &[id, layers] : scene.screen_layers) {
+      if (std::find(layers.begin(), layers.end(), layer_id) != layers.end())
+        screen_id = id;
+    }
+  }
+
+  if (surface_count == 1)
+    return grab_surface_async(surface_id, std::move(callback));
+  if (!screen_id) {
+    spdlog::error("Failed to find a screen showing layer {}", layer_id);
+    return callback(std::vector<raw_frame_t>(1));
+  }
+  submit_async(
+      {*screen_id}, false,
+      [area, callback = std::move(callback)](std::vector<raw_frame_t> frames) {
+        auto &frame = frames[0];
+        auto const x = std::max(area.x, 0);
+        auto const y = std::max(area.y, 0);
+        auto const width = std::min(area.x + area.width, frame.width) - x;
+        auto const height = std::min(area.y + area.height, frame.height) - y;
+        if (frame.data.empty() || width <= 0 || height <= 0) {
+          buffer_pool_t::instance().release(std::move(frame.data));
+          return callback(std::vector<raw_frame_t>(1));
+        }
+
+        auto &pool = buffer_pool_t::instance();
+        auto cropped = pool.acquire((size_t)width * 4 * height);
+        for (int row = 0; row < height; ++row) {
+          memcpy(cropped.data() + (size_t)row * width * 4,
+                 frame.data.data() + (size_t)(y + row) * frame.stride + x * 4,
+                 (size_t)width * 4);
+        }
+        pool.release(std::move(frame.data));
+        frame.data = std::move(cropped);
+        frame.width = width;
+        frame.height = height;
+        frame.stride = width * 4;
+        callback(std::move(frames));
+      });
+}
+
+ivi_scene_t ilm_screen_t::scene() {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return wayland_data.scene;
+}
+
+void ilm_screen_t::submit_async(std::vector<int> const &ids,
+                                bool const surfaces,
+                                raw_frames_callback_t callback) {
+  auto batch = std::make_unique<screenshot_batch_t>();
+  batch->screens = ids;
+  batch->surfaces = surfaces;
+  batch->frames.resize(ids.size());
+  batch->screen_shots.resize(ids.size());
+  for (std::size_t i = 0; i < ids.size(); ++i)
+    batch->screen_shots[i].raw_frame = &batch->frames[i];
+  batch->done = [this, callback = std::move(callback)](
+                    screenshot_batch_t &done_batch) mutable {
+    boost::asio::post(m_completions,
+                      [callback = std::move(callback),
+                       frames = std::move(done_batch.frames)]() mutable {
+                        callback(std::move(frames));
+                      });
+  };
+  submit(std::move(batch));
+}
+
+void ilm_screen_t::encode_raw_frame(raw_frame_t const &frame,
+                                    image_data_t &image) {
+  // bottom-up rows of B, G, R, A, written behind the header directly
+  write_bmp_rows(frame.data.data(), frame.stride, frame.width, frame.height,
+                 frame.rgb != 0,
+                 begin_bmp(frame.width, frame.height, frame.width * 4, image));
+}
+
 ilm_screen_t::~ilm_screen_t() {
+  if (m_dispatchThread.joinable()) {
+    m_running = false;
+    uint64_t const wake = 1;
+    if (write(m_wakeFd, &wake, sizeof wake) < 0)
+      spdlog::error("unable to stop the Wayland thread: {}", strerror(errno));
+    m_dispatchThread.join();
+  }
+  m_completions.join();
+  if (m_wakeFd >= 0)
+    close(m_wakeFd);
   if (!wayland_data.display)
     return;
 
@@ -25,13 +25,17 @@
 
 #include "backends/screen/kms.hpp"
 #include "backends/input/common.hpp"
+#include "drm_fourcc.h"
 #include "drm_mode.h"
 
 #include <spdlog/spdlog.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <algorithm>
+#include <future>
 #include <memory>
+#include <optional>
 
 namespace qadx {
 
@@ -63,7 +67,7 @@ std::vector<details::kms_screen_crtc_t> kms_screen_t::list_screens_impl() {
                    strerror(errno));
       continue;
     }
-    screens.push_back({crtc->crtc_id, crtc->mode_valid});
+    screens.push_back({crtc->crtc_id, crtc->mode_valid, crtc->buffer_id});
     drmModeFreeCrtc(crtc);
   }
   drmModeFreeResources(resources);
@@ -82,8 +86,83 @@ std::string kms_screen_t::list_screens() {
   return reply;
 }
 
-bool kms_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
-                                     int const screen_id) {
+namespace {
+struct frame_buffer_layout_t {
+  uint32_t format = 0;
+  uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+  int width = 0;
+  int height = 0;
+  std::array<uint32_t, 4> handles{};
+  std::array<uint32_t, 4> pitches{};
+  std::array<uint32_t, 4> offsets{};
+};
+
+// GETFB2 tells the pixel format, modifier and every plane, GETFB is the
+// fallback for kernels older than 5.7 and only knows depth and bpp
+std::optional<frame_buffer_layout_t> get_frame_buffer(int const file_descriptor,
+                                                      uint32_t const id) {
+  frame_buffer_layout_t layout{};
+  if (auto fb2 = drmModeGetFB2(file_descriptor, id); fb2) {
+    layout.format = fb2->pixel_format;
+    if (fb2->flags & DRM_MODE_FB_MODIFIERS)
+      layout.modifier = fb2->modifier;
+    layout.width = (int)fb2->width;
+    layout.height = (int)fb2->height;
+    for (std::size_t i = 0; i < layout.handles.size(); ++i) {
+      layout.handles[i] = fb2->handles[i];
+      layout.pitches[i] = fb2->pitches[i];
+      layout.offsets[i] = fb2->offsets[i];
+    }
+    drmModeFreeFB2(fb2);
+    return layout;
+  }
+
+  auto fb = drmModeGetFB(file_descriptor, id);
+  if (!fb)
+    return std::nullopt;
+  if (fb->bpp == 16)
+    layout.format = DRM_FORMAT_RGB565;
+  else if (fb->bpp == 32 && fb->depth == 30)
+    layout.format = DRM_FORMAT_XRGB2101010;
+  else if (fb->bpp == 32)
+    layout.format = DRM_FORMAT_XRGB8888;
+  layout.width = (int)fb->width;
+  layout.height = (int)fb->height;
+  layout.handles[0] = fb->handle;
+  layout.pitches[0] = fb->pitch;
+  drmModeFreeFB(fb);
+  return layout;
+}
+
+std::string fourcc_name(uint32_t const format) {
+  std::string name(4, ' ');
+  for (std::size_t i = 0; i < name.size(); ++i)
+    name[i] = (char)((format >> (8 * i)) & 0xffu);
+  return name;
+}
+
+bool convert_frame_buffer(details::kms_frame_buffer_t const &frame_buffer,
+                          raw_frame_t &frame) {
+  if (convert_frame(frame_buffer.format, frame_buffer.planes.data(),
+                    frame_buffer.width, frame_buffer.height, frame))
+    return true;
+  spdlog::error("Unsupported frame buffer format '{}'",
+                fourcc_name(frame_buffer.format));
+  return false;
+}
+} // namespace
+
+std::vector<int> kms_screen_t::screen_ids() {
+  std::vector<int> ids{};
+  for (auto const &screen_info : list_screens_impl()) {
+    if (screen_info.valid_mode == 1)
+      ids.push_back((int)screen_info.id);
+  }
+  return ids;
+}
+
+bool kms_screen_t::map_frame_buffer(int const screen_id,
+                                    frame_buffer_callback_t const &callback) {
   int file_descriptor = open(m_card.c_str(), O_RDWR | O_CLOEXEC);
   if (file_descriptor < 0) {
     spdlog::error("Error opening {}: {}", m_card, strerror(errno));
@@ -96,49 +175,176 @@ bool kms_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
     spdlog::error("Error getting CRTC '{}': {}", screen_id, strerror(errno));
     return false;
   }
-  drmModeFB *fb = drmModeGetFB(file_descriptor, crtc->buffer_id);
-  if (!fb) {
+  uint32_t const buffer_id = crtc->buffer_id;
+  drmModeFreeCrtc(crtc);
+
+  auto const layout = get_frame_buffer(file_descriptor, buffer_id);
+  if (!layout) {
     close(file_descriptor);
-    drmModeFreeCrtc(crtc);
-    spdlog::error("Error getting frame buffer '{}': {}", crtc->buffer_id,
+    spdlog::error("Error getting frame buffer '{}': {}", buffer_id,
                   strerror(errno));
     return false;
   }
+  // tiled and compressed layouts would need the GPU to detile them
+  if (layout->modifier != DRM_FORMAT_MOD_LINEAR &&
+      layout->modifier != DRM_FORMAT_MOD_INVALID) {
+    close(file_descriptor);
+    spdlog::error("Frame buffer '{}' has unsupported modifier {:#x}",
+                  buffer_id, layout->modifier);
+    return false;
+  }
+  if (layout->handles[0] == 0) {
+    close(file_descriptor);
+    spdlog::error("No handle to frame buffer '{}', is qadx running as root?",
+                  buffer_id);
+    return false;
+  }
 
-  auto const fb_size = fb->pitch * fb->height;
-  drm_mode_map_dumb dumb_map{};
-  dumb_map.handle = fb->handle;
-  dumb_map.offset = 0;
+  // planes sharing a buffer object, like the two of NV12 usually do, share
+  // one mapping that covers all of them. Only 4:2:0 has more than one plane
+  // among the formats that can be converted, which gives the chroma height.
+  struct mapping_t {
+    uint32_t handle = 0;
+    size_t size = 0;
+    void *ptr = MAP_FAILED;
+  };
+  std::vector<mapping_t> mappings{};
+  std::array<std::size_t, 4> plane_mappings{};
+  std::size_t plane_count = 0;
+  for (; plane_count < layout->handles.size(); ++plane_count) {
+    auto const handle = layout->handles[plane_count];
+    if (handle == 0)
+      break;
+    auto const plane_height =
+        plane_count == 0 ? layout->height : (layout->height + 1) / 2;
+    size_t const end = (size_t)layout->offsets[plane_count] +
+                       (size_t)layout->pitches[plane_count] * plane_height;
+    auto iter = std::find_if(
+        mappings.begin(), mappings.end(),
+        [handle](auto const &mapping) { return mapping.handle == handle; });
+    if (iter == mappings.end()) {
+      mappings.push_back({handle, end});
+      iter = std::prev(mappings.end());
+    }
+    iter->size = std::max(iter->size, end);
+    plane_mappings[plane_count] = (std::size_t)(iter - mappings.begin());
+  }
 
-  drmIoctl(file_descriptor, DRM_IOCTL_MODE_MAP_DUMB, &dumb_map);
-  auto ptr = mmap(nullptr, fb_size, PROT_READ, MAP_SHARED, file_descriptor,
-                  __off_t(dumb_map.offset));
-  mmap_auto_free_t auto_free(ptr, fb_size);
-  write_png(ptr, (int)fb->width, int(fb->height), int(fb->pitch), (int)fb->bpp,
-            0, screen_buffer);
-  drmModeFreeFB(fb);
-  drmModeFreeCrtc(crtc);
+  bool mapped = true;
+  for (auto &mapping : mappings) {
+    drm_mode_map_dumb dumb_map{};
+    dumb_map.handle = mapping.handle;
+    dumb_map.offset = 0;
+    drmIoctl(file_descriptor, DRM_IOCTL_MODE_MAP_DUMB, &dumb_map);
+    mapping.ptr = mmap(nullptr, mapping.size, PROT_READ, MAP_SHARED,
+                       file_descriptor, __off_t(dumb_map.offset));
+    if (mapping.ptr == MAP_FAILED) {
+      spdlog::error("Error mapping frame buffer '{}': {}", buffer_id,
+                    strerror(errno));
+      mapped = false;
+      break;
+    }
+  }
+
+  if (mapped) {
+    details::kms_frame_buffer_t frame_buffer{};
+    frame_buffer.format = layout->format;
+    frame_buffer.width = layout->width;
+    frame_buffer.height = layout->height;
+    for (std::size_t i = 0; i < plane_count; ++i) {
+      auto const &mapping = mappings[plane_mappings[i]];
+      frame_buffer.planes[i].data =
+          static_cast<unsigned char const *>(mapping.ptr) + layout->offsets[i];
+      frame_buffer.planes[i].pitch = (int)layout->pitches[i];
+    }
+    callback(frame_buffer);
+  }
+  for (auto const &mapping : mappings) {
+    if (mapping.ptr != MAP_FAILED)
+      munmap(mapping.ptr, mapping.size);
+  }
+  close(file_descriptor);
+  return mapped;
+}
+
+bool kms_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
+                                     int const screen_id) {
+  bool converted = true;
+  bool const mapped = map_frame_buffer(
+      screen_id, [&](details::kms_frame_buffer_t const &frame_buffer) {
+        auto const &plane = frame_buffer.planes[0];
+        // libpng reads both 32-bit RGB orders straight from the mapping
+        if (frame_buffer.format == DRM_FORMAT_XRGB8888 ||
+            frame_buffer.format == DRM_FORMAT_ARGB8888 ||
+            frame_buffer.format == DRM_FORMAT_XBGR8888 ||
+            frame_buffer.format == DRM_FORMAT_ABGR8888) {
+          int const rgb = frame_buffer.format == DRM_FORMAT_XBGR8888 ||
+                          frame_buffer.format == DRM_FORMAT_ABGR8888;
+          return write_png(const_cast<void *>(plane.data), frame_buffer.width,
+                           frame_buffer.height, plane.pitch, 32, rgb,
+                           screen_buffer);
+        }
+        raw_frame_t frame{};
+        converted = convert_frame_buffer(frame_buffer, frame);
+        if (converted)
+          encode_raw_frame(frame, screen_buffer);
+        buffer_pool_t::instance().release(std::move(frame.data));
+      });
+  return mapped && converted;
+}
+
+bool kms_screen_t::grab_raw_frame(raw_frame_t &frame, int const screen_id) {
+  bool converted = true;
+  bool const mapped = map_frame_buffer(
+      screen_id, [&](details::kms_frame_buffer_t const &frame_buffer) {
+        converted = convert_frame_buffer(frame_buffer, frame);
+      });
+  return mapped && converted;
+}
+
+std::optional<uint64_t> kms_screen_t::frame_token(int const screen_id) {
+  // a page flip scans out another frame buffer, which is all it takes to
+  // notice a new frame without mapping anything. Rendering straight into the
+  // buffer on screen goes unnoticed.
+  int file_descriptor = open(m_card.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_descriptor < 0)
+    return std::nullopt;
+  std::optional<uint64_t> token{};
+  if (auto crtc = drmModeGetCrtc(file_descriptor, screen_id); crtc) {
+    token = crtc->buffer_id;
+    drmModeFreeCrtc(crtc);
+  }
   close(file_descriptor);
-  return true;
+  return token;
+}
+
+bool kms_screen_t::probe() {
+  for (auto const &screen_info : list_screens_impl()) {
+    if (screen_info.valid_mode != 1 || screen_info.buffer_id == 0)
+      continue;
+    // mapping the frame buffer without reading it proves it can be grabbed
+    if (map_frame_buffer((int)screen_info.id,
+                         [](details::kms_frame_buffer_t const &) {}))
+      return true;
+  }
+  return false;
 }
 
 std::string select_suitable_kms_card(string_list_t const &cards, int const) {
+  // the cards are probed concurrently, the first suitable one in `cards`
+  // is picked
+  std::vector<std::future<bool>> probes{};
+  probes.reserve(cards.size());
   for (auto const &card : cards) {
-    int screen_id = 2;
-    kms_screen_t kms_screen{};
-    kms_screen.m_card += card;
-    {
-      auto const screens = kms_screen.list_screens_impl();
-      auto valid_screen_iter = std::find_if(
-          screens.begin(), screens.end(),
-          [](auto const &screen_info) { return screen_info.valid_mode == 1; });
-      if (valid_screen_iter != screens.end())
-        screen_id = (int)valid_screen_iter->id;
-    }
-
-    image_data_t image{};
-    if (kms_screen.grab_frame_buffer(image, screen_id))
-      return card;
+    probes.push_back(std::async(std::launch::async, [card] {
+      kms_screen_t kms_screen{};
+      kms_screen.m_card += card;
+      return kms_screen.probe();
+    }));
+  }
+  for (std::size_t i = 0; i < cards.size(); ++i) {
+    if (probes[i].get())
+      return cards[i];
   }
   return {};
 }
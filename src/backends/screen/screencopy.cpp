@@ -0,0 +1,419 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "backends/screen/screencopy.hpp"
+#include "drm_fourcc.h"
+
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace qadx {
+namespace {
+void output_geometry(void *, wl_output *, int32_t, int32_t, int32_t, int32_t,
+                     int32_t, char const *, char const *, int32_t) {}
+void output_mode(void *data, wl_output *, uint32_t const flags,
+                 int32_t const width, int32_t const height, int32_t) {
+  auto output = reinterpret_cast<screencopy_output_t *>(data);
+  if (flags & WL_OUTPUT_MODE_CURRENT) {
+    output->width = width;
+    output->height = height;
+  }
+}
+void output_done(void *, wl_output *) {}
+void output_scale(void *, wl_output *, int32_t) {}
+
+wl_output_listener const output_listener = {
+    output_geometry,
+    output_mode,
+    output_done,
+    output_scale,
+};
+
+// what the compositor says about the frame being captured
+struct screencopy_frame_t {
+  uint32_t format = 0;
+  int width = 0;
+  int height = 0;
+  int stride = 0;
+  uint32_t flags = 0;
+  bool buffer_known = false;
+  bool finished = false;
+  bool failed = false;
+};
+
+void frame_buffer(void *data, zwlr_screencopy_frame_v1 *,
+                  uint32_t const format, uint32_t const width,
+                  uint32_t const height, uint32_t const stride) {
+  auto frame = reinterpret_cast<screencopy_frame_t *>(data);
+  frame->format = format;
+  frame->width = static_cast<int>(width);
+  frame->height = static_cast<int>(height);
+  frame->stride = static_cast<int>(stride);
+  frame->buffer_known = true;
+}
+void frame_flags(void *data, zwlr_screencopy_frame_v1 *, uint32_t const flags) {
+  reinterpret_cast<screencopy_frame_t *>(data)->flags = flags;
+}
+void frame_ready(void *data, zwlr_screencopy_frame_v1 *, uint32_t, uint32_t,
+                 uint32_t) {
+  reinterpret_cast<screencopy_frame_t *>(data)->finished = true;
+}
+void frame_failed(void *data, zwlr_screencopy_frame_v1 *) {
+  auto frame = reinterpret_cast<screencopy_frame_t *>(data);
+  frame->failed = true;
+  frame->buffer_known = true;
+  frame->finished = true;
+}
+void frame_damage(void *, zwlr_screencopy_frame_v1 *, uint32_t, uint32_t,
+                  uint32_t, uint32_t) {}
+void frame_linux_dmabuf(void *, zwlr_screencopy_frame_v1 *, uint32_t, uint32_t,
+                        uint32_t) {}
+void frame_buffer_done(void *, zwlr_screencopy_frame_v1 *) {}
+
+zwlr_screencopy_frame_v1_listener const frame_listener = {
+    frame_buffer, frame_flags,        frame_ready,       frame_failed,
+    frame_damage, frame_linux_dmabuf, frame_buffer_done,
+};
+
+// wl_shm names its two oldest formats differently from DRM
+uint32_t to_drm_format(uint32_t const shm_format) {
+  switch (shm_format) {
+  case WL_SHM_FORMAT_ARGB8888:
+    return DRM_FORMAT_ARGB8888;
+  case WL_SHM_FORMAT_XRGB8888:
+    return DRM_FORMAT_XRGB8888;
+  default:
+    return shm_format;
+  }
+}
+
+void release_shm_buffer(screencopy_output_t &output) {
+  if (output.buffer)
+    wl_buffer_destroy(output.buffer);
+  if (output.memory)
+    munmap(output.memory, output.size);
+  output.buffer = nullptr;
+  output.memory = nullptr;
+  output.size = 0;
+}
+
+bool copy_frame(screencopy_output_t const &output, bool const y_invert,
+                raw_frame_t &frame) {
+  frame_plane_t plane{};
+  plane.data = output.memory;
+  plane.pitch = output.stride;
+  if (!convert_frame(to_drm_format(output.format), &plane, output.buffer_width,
+                     output.buffer_height, frame)) {
+    spdlog::error("unsupported pixel format {:#x}", output.format);
+    return false;
+  }
+  if (y_invert) {
+    auto const row_size = (std::size_t)frame.stride;
+    for (int top = 0, bottom = frame.height - 1; top < bottom;
+         ++top, --bottom) {
+      std::swap_ranges(frame.data.data() + top * row_size,
+                       frame.data.data() + (top + 1) * row_size,
+                       frame.data.data() + bottom * row_size);
+    }
+  }
+  return true;
+}
+} // namespace
+
+void screenshooter_done(void *data, weston_screenshooter *) {
+  reinterpret_cast<screencopy_screen_t *>(data)->m_shooterDone = true;
+}
+
+static weston_screenshooter_listener const screenshooter_listener = {
+    screenshooter_done,
+};
+
+void screencopy_registry_handler(void *data, wl_registry *registry,
+                                 uint32_t const name, char const *interface,
+                                 uint32_t const version) {
+  auto screen = reinterpret_cast<screencopy_screen_t *>(data);
+  if (strcmp(interface, wl_output_interface.name) == 0) {
+    auto output = std::make_unique<screencopy_output_t>();
+    output->output = reinterpret_cast<wl_output *>(
+        wl_registry_bind(registry, name, &wl_output_interface, 1));
+    output->global_name = name;
+    output->screen_id = screen->m_nextScreenId++;
+    wl_output_add_listener(output->output, &output_listener, output.get());
+    screen->m_outputs.push_back(std::move(output));
+  } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+    screen->m_shm = reinterpret_cast<wl_shm *>(
+        wl_registry_bind(registry, name, &wl_shm_interface, 1));
+  } else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) ==
+             0) {
+    // version 1 is all we need: a single shm buffer and no damage tracking
+    screen->m_screencopy = reinterpret_cast<zwlr_screencopy_manager_v1 *>(
+        wl_registry_bind(registry, name, &zwlr_screencopy_manager_v1_interface,
+                         std::min(version, 1u)));
+  } else if (strcmp(interface, weston_screenshooter_interface.name) == 0) {
+    screen->m_screenshooter = reinterpret_cast<weston_screenshooter *>(
+        wl_registry_bind(registry, name, &weston_screenshooter_interface, 1));
+    weston_screenshooter_add_listener(screen->m_screenshooter,
+                                      &screenshooter_listener, screen);
+  }
+}
+
+void screencopy_registry_remover(void *data, wl_registry *,
+                                 uint32_t const name) {
+  auto screen = reinterpret_cast<screencopy_screen_t *>(data);
+  auto &outputs = screen->m_outputs;
+  auto iter = std::find_if(outputs.begin(), outputs.end(),
+                           [name](auto const &output) {
+                             return output->global_name == name;
+                           });
+  if (iter == outputs.end())
+    return;
+  spdlog::info("Screen {} removed", (*iter)->screen_id);
+  // this may run inside a capture of the very same output, which erases it
+  // once it is done with it
+  (*iter)->removed = true;
+}
+
+static wl_registry_listener const registry_listener = {
+    screencopy_registry_handler,
+    screencopy_registry_remover,
+};
+
+std::unique_ptr<screencopy_screen_t> create_screencopy_instance() {
+  std::unique_ptr<screencopy_screen_t> screen(new screencopy_screen_t());
+  screen->m_display = wl_display_connect(nullptr);
+  if (!screen->m_display) {
+    spdlog::error("failed to connect to WL display: {}", strerror(errno));
+    return nullptr;
+  }
+
+  screen->m_queue = wl_display_create_queue(screen->m_display);
+  screen->m_registry = wl_display_get_registry(screen->m_display);
+  wl_proxy_set_queue((wl_proxy *)screen->m_registry, screen->m_queue);
+  wl_registry_add_listener(screen->m_registry, &registry_listener,
+                           screen.get());
+
+  // the globals, then the modes of the outputs just bound
+  for (int i = 0; i < 2; ++i) {
+    if (wl_display_roundtrip_queue(screen->m_display, screen->m_queue) == -1) {
+      spdlog::error("Failed to get globals");
+      return nullptr;
+    }
+  }
+
+  if (!screen->m_shm) {
+    spdlog::error("Compositor does not offer wl_shm");
+    return nullptr;
+  }
+  if (screen->m_screencopy) {
+    spdlog::info("Capturing screens with wlr-screencopy");
+  } else if (screen->m_screenshooter) {
+    spdlog::info("Capturing screens with weston-screenshooter");
+  } else {
+    spdlog::error("Compositor offers neither wlr-screencopy nor "
+                  "weston-screenshooter, is weston running with --debug?");
+    return nullptr;
+  }
+  return screen;
+}
+
+screencopy_screen_t *screencopy_screen_t::create_global_instance() {
+  static auto instance = create_screencopy_instance();
+  return instance.get();
+}
+
+screencopy_screen_t::~screencopy_screen_t() {
+  if (!m_display)
+    return;
+
+  for (auto &output : m_outputs) {
+    release_shm_buffer(*output);
+    wl_output_destroy(output->output);
+  }
+  if (m_screencopy)
+    zwlr_screencopy_manager_v1_destroy(m_screencopy);
+  if (m_screenshooter)
+    weston_screenshooter_destroy(m_screenshooter);
+  if (m_shm)
+    wl_shm_destroy(m_shm);
+  if (m_registry)
+    wl_registry_destroy(m_registry);
+  if (m_queue)
+    wl_event_queue_destroy(m_queue);
+  wl_display_disconnect(m_display);
+}
+
+std::string screencopy_screen_t::list_screens() {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  // outputs plugged in since the last capture
+  wl_display_dispatch_queue_pending(m_display, m_queue);
+  erase_removed_outputs();
+  std::string reply{};
+  for (auto const &output : m_outputs) {
+    reply += fmt::format("OUTPUT: ID={}, size={}x{}\n", output->screen_id,
+                         output->width, output->height);
+  }
+  return reply;
+}
+
+std::vector<int> screencopy_screen_t::screen_ids() {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  erase_removed_outputs();
+  std::vector<int> ids{};
+  for (auto const &output : m_outputs)
+    ids.push_back(output->screen_id);
+  return ids;
+}
+
+void screencopy_screen_t::erase_removed_outputs() {
+  auto const first_removed = std::stable_partition(
+      m_outputs.begin(), m_outputs.end(),
+      [](auto const &output) { return !output->removed; });
+  for (auto iter = first_removed; iter != m_outputs.end(); ++iter) {
+    release_shm_buffer(**iter);
+    wl_output_destroy((*iter)->output);
+  }
+  m_outputs.erase(first_removed, m_outputs.end());
+}
+
+bool screencopy_screen_t::dispatch_until(bool const &condition) {
+  while (!condition) {
+    if (wl_display_dispatch_queue(m_display, m_queue) == -1) {
+      spdlog::error("lost the Wayland display: {}", strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+bool screencopy_screen_t::ensure_shm_buffer(screencopy_output_t &output,
+                                            uint32_t const format,
+                                            int const width, int const height,
+                                            int const stride) {
+  if (output.buffer && output.format == format &&
+      output.buffer_width == width && output.buffer_height == height &&
+      output.stride == stride)
+    return true;
+
+  release_shm_buffer(output);
+  auto const size = (std::size_t)stride * height;
+  int const fd = memfd_create("qadx-screencopy", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+    spdlog::error("unable to allocate a {} byte buffer: {}", size,
+                  strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    spdlog::error("unable to map a {} byte buffer: {}", size, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  auto pool = wl_shm_create_pool(m_shm, fd, (int32_t)size);
+  output.buffer =
+      wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
+  wl_shm_pool_destroy(pool);
+  close(fd);
+  output.memory = memory;
+  output.size = size;
+  output.format = format;
+  output.buffer_width = width;
+  output.buffer_height = height;
+  output.stride = stride;
+  return output.buffer != nullptr;
+}
+
+bool screencopy_screen_t::capture(screencopy_output_t &output,
+                                  bool &y_invert) {
+  y_invert = false;
+  if (!m_screencopy) {
+    // the screenshooter copies the current mode, top-down, in ARGB8888
+    if (!ensure_shm_buffer(output, WL_SHM_FORMAT_ARGB8888, output.width,
+                           output.height, output.width * 4))
+      return false;
+    m_shooterDone = false;
+    weston_screenshooter_shoot(m_screenshooter, output.output, output.buffer);
+    return dispatch_until(m_shooterDone);
+  }
+
+  screencopy_frame_t frame{};
+  auto frame_proxy =
+      zwlr_screencopy_manager_v1_capture_output(m_screencopy, 0, output.output);
+  zwlr_screencopy_frame_v1_add_listener(frame_proxy, &frame_listener, &frame);
+  bool copied = dispatch_until(frame.buffer_known) && !frame.failed &&
+                ensure_shm_buffer(output, frame.format, frame.width,
+                                  frame.height, frame.stride);
+  if (copied) {
+    zwlr_screencopy_frame_v1_copy(frame_proxy, output.buffer);
+    copied = dispatch_until(frame.finished) && !frame.failed;
+  }
+  zwlr_screencopy_frame_v1_destroy(frame_proxy);
+  y_invert = (frame.flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT) != 0;
+  if (frame.failed)
+    spdlog::error("Compositor failed to copy screen {}", output.screen_id);
+  return copied;
+}
+
+bool screencopy_screen_t::grab_raw_frame(raw_frame_t &frame, int const screen) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto iter = std::find_if(m_outputs.begin(), m_outputs.end(),
+                           [screen](auto const &output) {
+                             return output->screen_id == screen &&
+                                    !output->removed;
+                           });
+  if (iter == m_outputs.end()) {
+    spdlog::error("Failed to find screen with ID {}", screen);
+    return false;
+  }
+
+  auto &output = **iter;
+  bool y_invert = false;
+  bool grabbed = capture(output, y_invert);
+  if (grabbed && output.removed) {
+    spdlog::error("Screen {} was removed while being captured", screen);
+    grabbed = false;
+  }
+  grabbed = grabbed && copy_frame(output, y_invert, frame);
+  // nothing refers to the outputs removed during the capture any more
+  erase_removed_outputs();
+  return grabbed;
+}
+
+bool screencopy_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
+                                            int const screen) {
+  raw_frame_t frame{};
+  bool const grabbed = grab_raw_frame(frame, screen);
+  if (grabbed)
+    encode_raw_frame(frame, screen_buffer);
+  buffer_pool_t::instance().release(std::move(frame.data));
+  return grabbed;
+}
+} // namespace qadx
@@ -0,0 +1,364 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "backends/screen/synthetic.hpp"
+#include "drm_fourcc.h"
+
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace qadx {
+namespace {
+// frames the generated pattern loops over
+constexpr int pattern_frames = 8;
+
+std::size_t frame_size(uint32_t const format, int const width,
+                       int const height) {
+  switch (format) {
+  case DRM_FORMAT_RGB565:
+    return (size_t)width * height * 2;
+  case DRM_FORMAT_NV12:
+    return (size_t)width * height + (size_t)width * ((height + 1) / 2);
+  default:
+    return (size_t)width * height * 4;
+  }
+}
+
+inline uint32_t expand_to_10_bits(uint32_t const value) {
+  return (value << 2) | (value >> 6);
+}
+
+// the inverse of convert_frame: stores a BGRX frame in `format`
+void store_frame(raw_frame_t const &frame, uint32_t const format,
+                 unsigned char *out) {
+  auto const width = frame.width;
+  auto const height = frame.height;
+  if (format == DRM_FORMAT_NV12) {
+    // BT.601 limited range, chroma from the top left pixel of each 2x2 block
+    auto const chroma = out + (size_t)width * height;
+    for (int y = 0; y < height; ++y) {
+      auto const row = frame.data.data() + (size_t)y * frame.stride;
+      for (int x = 0; x < width; ++x) {
+        int const b = row[x * 4];
+        int const g = row[x * 4 + 1];
+        int const r = row[x * 4 + 2];
+        out[(size_t)y * width + x] =
+            (unsigned char)((66 * r + 129 * g + 25 * b + 128) / 256 + 16);
+        if ((y & 1) == 0 && (x & 1) == 0) {
+          auto const uv = chroma + (size_t)(y / 2) * width + x;
+          uv[0] = (unsigned char)((-38 * r - 74 * g + 112 * b + 128) / 256 +
+                                  128);
+          uv[1] = (unsigned char)((112 * r - 94 * g - 18 * b + 128) / 256 +
+                                  128);
+        }
+      }
+    }
+    return;
+  }
+
+  for (int y = 0; y < height; ++y) {
+    auto const row = frame.data.data() + (size_t)y * frame.stride;
+    for (int x = 0; x < width; ++x) {
+      uint32_t const b = row[x * 4];
+      uint32_t const g = row[x * 4 + 1];
+      uint32_t const r = row[x * 4 + 2];
+      uint32_t pixel = 0;
+      switch (format) {
+      case DRM_FORMAT_XBGR8888:
+      case DRM_FORMAT_ABGR8888:
+        pixel = (b << 16) | (g << 8) | r;
+        break;
+      case DRM_FORMAT_RGB565: {
+        uint16_t const packed =
+            (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+        memcpy(out, &packed, sizeof(packed));
+        out += sizeof(packed);
+        continue;
+      }
+      case DRM_FORMAT_XRGB2101010:
+      case DRM_FORMAT_ARGB2101010:
+        pixel = (expand_to_10_bits(r) << 20) | (expand_to_10_bits(g) << 10) |
+                expand_to_10_bits(b);
+        break;
+      case DRM_FORMAT_XBGR2101010:
+      case DRM_FORMAT_ABGR2101010:
+        pixel = (expand_to_10_bits(b) << 20) | (expand_to_10_bits(g) << 10) |
+                expand_to_10_bits(r);
+        break;
+      default:
+        pixel = (r << 16) | (g << 8) | b;
+        break;
+      }
+      memcpy(out, &pixel, sizeof(pixel));
+      out += sizeof(pixel);
+    }
+  }
+}
+
+// colour bars over a grey ramp, with a block moving across them from one
+// frame to the next
+void draw_pattern(int const index, raw_frame_t &frame) {
+  static constexpr uint32_t bars[] = {0xffffff, 0xffff00, 0x00ffff, 0x00ff00,
+                                      0xff00ff, 0xff0000, 0x0000ff, 0x000000};
+  auto const width = frame.width;
+  auto const height = frame.height;
+  auto const block = std::max(1, height / 6);
+  auto const block_x = (width - block) * index / (pattern_frames - 1);
+  auto const block_y = (height * 2 / 3 - block) / 2;
+  for (int y = 0; y < height; ++y) {
+    auto const row =
+        reinterpret_cast<uint32_t *>(frame.data.data() + (size_t)y * frame.stride);
+    for (int x = 0; x < width; ++x) {
+      uint32_t pixel = 0;
+      if (y < height * 2 / 3) {
+        pixel = bars[x * 8 / width];
+      } else {
+        uint32_t const grey = (uint32_t)(x * 255 / (width - 1));
+        pixel = (grey << 16) | (grey << 8) | grey;
+      }
+      if (x >= block_x && x < block_x + block && y >= block_y &&
+          y < block_y + block)
+        pixel ^= 0xffffff;
+      row[x] = pixel;
+    }
+  }
+}
+
+// every PNG of a directory in name order, or a single PNG
+std::vector<std::filesystem::path> png_sources(std::string const &source) {
+  namespace fs = std::filesystem;
+  std::vector<fs::path> paths{};
+  if (!fs::is_directory(source)) {
+    paths.emplace_back(source);
+    return paths;
+  }
+  for (auto const &entry : fs::directory_iterator(source)) {
+    if (entry.is_regular_file() && entry.path().extension() == ".png")
+      paths.push_back(entry.path());
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+bool is_png_source(std::string const &source) {
+  return std::filesystem::is_directory(source) ||
+         std::filesystem::path(source).extension() == ".png";
+}
+} // namespace
+
+std::unique_ptr<synthetic_screen_t>
+create_instance(synthetic_args_t const &args) {
+  if (!can_convert_frame(args.format)) {
+    spdlog::error("unsupported synthetic pixel format");
+    return nullptr;
+  }
+  if (args.format == DRM_FORMAT_NV12 && (args.width & 1)) {
+    spdlog::error("NV12 synthetic frames need an even width");
+    return nullptr;
+  }
+  std::unique_ptr<synthetic_screen_t> screen(new synthetic_screen_t(args));
+  auto &screen_args = screen->m_args;
+
+  // raw frames are served straight from the file they're in
+  if (args.source != "pattern" && !is_png_source(args.source)) {
+    screen->m_frameSize = frame_size(args.format, args.width, args.height);
+    int file_descriptor = open(args.source.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat file_stat {};
+    if (file_descriptor < 0 || fstat(file_descriptor, &file_stat) != 0) {
+      spdlog::error("Error opening {}: {}", args.source, strerror(errno));
+      if (file_descriptor >= 0)
+        close(file_descriptor);
+      return nullptr;
+    }
+    screen->m_frameCount = (size_t)file_stat.st_size / screen->m_frameSize;
+    if (screen->m_frameCount == 0) {
+      close(file_descriptor);
+      spdlog::error("{} doesn't hold a single {}x{} frame", args.source,
+                    args.width, args.height);
+      return nullptr;
+    }
+    screen->m_mappedSize = screen->m_frameCount * screen->m_frameSize;
+    screen->m_frames = mmap(nullptr, screen->m_mappedSize, PROT_READ,
+                            MAP_PRIVATE, file_descriptor, 0);
+    close(file_descriptor);
+    if (screen->m_frames == MAP_FAILED) {
+      screen->m_frames = nullptr;
+      spdlog::error("Error mapping {}: {}", args.source, strerror(errno));
+      return nullptr;
+    }
+    return screen;
+  }
+
+  // anything else is drawn or decoded once, into a memfd
+  std::vector<raw_frame_t> frames{};
+  if (args.source == "pattern") {
+    frames.resize(pattern_frames);
+    for (int i = 0; i < pattern_frames; ++i) {
+      auto &frame = frames[i];
+      frame.width = args.width;
+      frame.height = args.height;
+      frame.stride = args.width * 4;
+      ensure_buffer_size(frame.data, (size_t)frame.stride * frame.height);
+      draw_pattern(i, frame);
+    }
+  } else {
+    for (auto const &path : png_sources(args.source)) {
+      raw_frame_t frame{};
+      if (!read_png(path.string(), frame)) {
+        spdlog::error("Error reading {}", path.string());
+        return nullptr;
+      }
+      if (!frames.empty() && (frame.width != frames[0].width ||
+                              frame.height != frames[0].height)) {
+        spdlog::error("{} isn't the size of the frames before it",
+                      path.string());
+        return nullptr;
+      }
+      frames.push_back(std::move(frame));
+    }
+    if (frames.empty()) {
+      spdlog::error("No PNG frames in {}", args.source);
+      return nullptr;
+    }
+    // the images decide the resolution
+    screen_args.width = frames[0].width;
+    screen_args.height = frames[0].height;
+  }
+
+  screen->m_frameSize =
+      frame_size(args.format, screen_args.width, screen_args.height);
+  screen->m_frameCount = frames.size();
+  screen->m_mappedSize = screen->m_frameCount * screen->m_frameSize;
+  int file_descriptor = memfd_create("qadx-synthetic", MFD_CLOEXEC);
+  if (file_descriptor < 0 ||
+      ftruncate(file_descriptor, (off_t)screen->m_mappedSize) != 0) {
+    spdlog::error("Error creating synthetic frames: {}", strerror(errno));
+    if (file_descriptor >= 0)
+      close(file_descriptor);
+    return nullptr;
+  }
+  screen->m_frames = mmap(nullptr, screen->m_mappedSize,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor,
+                          0);
+  close(file_descriptor);
+  if (screen->m_frames == MAP_FAILED) {
+    screen->m_frames = nullptr;
+    spdlog::error("Error mapping synthetic frames: {}", strerror(errno));
+    return nullptr;
+  }
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    store_frame(frames[i], args.format,
+                static_cast<unsigned char *>(screen->m_frames) +
+                    i * screen->m_frameSize);
+  }
+  mprotect(screen->m_frames, screen->m_mappedSize, PROT_READ);
+  return screen;
+}
+
+synthetic_screen_t *
+synthetic_screen_t::create_global_instance(synthetic_args_t const &args) {
+  static auto instance = create_instance(args);
+  return instance.get();
+}
+
+synthetic_screen_t::~synthetic_screen_t() {
+  if (m_frames)
+    munmap(m_frames, m_mappedSize);
+}
+
+std::size_t synthetic_screen_t::frame_index() const {
+  auto const elapsed = std::chrono::steady_clock::now() - m_start;
+  auto const frame_number =
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() *
+      m_args.fps / 1'000'000;
+  return (size_t)frame_number % m_frameCount;
+}
+
+std::string synthetic_screen_t::list_screens() {
+  std::string reply{};
+  for (int i = 0; i < m_args.screens; ++i) {
+    reply += fmt::format("SYNTHETIC: ID={}, size={}x{}, frames={}\n", i,
+                         m_args.width, m_args.height, m_frameCount);
+  }
+  return reply;
+}
+
+std::vector<int> synthetic_screen_t::screen_ids() {
+  std::vector<int> ids(m_args.screens);
+  for (int i = 0; i < m_args.screens; ++i)
+    ids[i] = i;
+  return ids;
+}
+
+std::optional<uint64_t> synthetic_screen_t::frame_token(int const screen) {
+  if (screen < 0 || screen >= m_args.screens)
+    return std::nullopt;
+  return frame_index();
+}
+
+bool synthetic_screen_t::grab_raw_frame(raw_frame_t &frame, int const screen) {
+  if (screen < 0 || screen >= m_args.screens) {
+    spdlog::error("Failed to find screen with ID {}", screen);
+    return false;
+  }
+
+  auto const data = static_cast<unsigned char const *>(m_frames) +
+                    frame_index() * m_frameSize;
+  frame_plane_t planes[2]{};
+  planes[0].data = data;
+  switch (m_args.format) {
+  case DRM_FORMAT_RGB565:
+    planes[0].pitch = m_args.width * 2;
+    break;
+  case DRM_FORMAT_NV12:
+    planes[0].pitch = m_args.width;
+    planes[1].data = data + (size_t)m_args.width * m_args.height;
+    planes[1].pitch = m_args.width;
+    break;
+  default:
+    planes[0].pitch = m_args.width * 4;
+    break;
+  }
+  return convert_frame(m_args.format, planes, m_args.width, m_args.height,
+                       frame);
+}
+
+bool synthetic_screen_t::grab_frame_buffer(image_data_t &screen_buffer,
+                                           int const screen) {
+  raw_frame_t frame{};
+  bool const grabbed = grab_raw_frame(frame, screen);
+  if (grabbed)
+    encode_raw_frame(frame, screen_buffer);
+  buffer_pool_t::instance().release(std::move(frame.data));
+  return grabbed;
+}
+} // namespace qadx
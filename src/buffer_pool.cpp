@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "buffer_pool.hpp"
+
+#include "image.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+
+namespace qadx {
+namespace details {
+enum constant_e : std::size_t {
+  HugePageSize = 2 * 1'024 * 1'024,
+  // below this, malloc is as good as it gets
+  MmapThreshold = 1'024 * 1'024,
+  MaxPooledBuffers = 32,
+  MaxPooledBytes = 256 * 1'024 * 1'024,
+  // a pooled buffer is only handed out for requests at least this fraction
+  // of its capacity, so a JPEG doesn't take and keep a full frame's buffer
+  MaxSlackFactor = 2,
+};
+
+std::atomic_bool huge_pages_enabled = false;
+
+std::size_t mapped_size(std::size_t const bytes) {
+  return (bytes + HugePageSize - 1) & ~(std::size_t)(HugePageSize - 1);
+}
+
+void *allocate_pixels(std::size_t const bytes) {
+  if (bytes < MmapThreshold) {
+    if (auto pointer = std::malloc(bytes); pointer)
+      return pointer;
+    throw std::bad_alloc();
+  }
+
+  // over-map by one huge page to be able to align the start on one
+  auto const length = mapped_size(bytes);
+  auto mapping = static_cast<char *>(mmap(nullptr, length + HugePageSize,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (mapping == MAP_FAILED)
+    throw std::bad_alloc();
+  auto const address = reinterpret_cast<std::uintptr_t>(mapping);
+  auto const aligned =
+      (address + HugePageSize - 1) & ~(std::uintptr_t)(HugePageSize - 1);
+  auto const head = aligned - address;
+  if (head != 0)
+    munmap(mapping, head);
+  if (auto const tail = HugePageSize - head; tail != 0)
+    munmap(reinterpret_cast<char *>(aligned) + length, tail);
+
+  auto pointer = reinterpret_cast<void *>(aligned);
+  if (huge_pages_enabled)
+    madvise(pointer, length, MADV_HUGEPAGE);
+  return pointer;
+}
+
+void free_pixels(void *pointer, std::size_t const bytes) {
+  if (bytes < MmapThreshold)
+    return std::free(pointer);
+  munmap(pointer, mapped_size(bytes));
+}
+} // namespace details
+
+buffer_pool_t &buffer_pool_t::instance() {
+  static buffer_pool_t pool{};
+  return pool;
+}
+
+void buffer_pool_t::use_huge_pages(bool const enable) {
+  details::huge_pages_enabled = enable;
+}
+
+qad_screen_buffer_t buffer_pool_t::acquire(std::size_t const size) {
+  auto buffer = acquire_empty(size);
+  buffer.resize(size);
+  return buffer;
+}
+
+qad_screen_buffer_t buffer_pool_t::acquire_empty(std::size_t const capacity) {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    // the smallest pooled buffer that fits, if it isn't far too large
+    if (auto iter = m_buffers.lower_bound(capacity);
+        iter != m_buffers.end() &&
+        iter->first / details::MaxSlackFactor <= capacity) {
+      auto buffer = std::move(iter->second);
+      m_pooledBytes -= iter->first;
+      m_buffers.erase(iter);
+      buffer.clear();
+      return buffer;
+    }
+  }
+  qad_screen_buffer_t buffer{};
+  buffer.reserve(capacity);
+  return buffer;
+}
+
+void buffer_pool_t::release(qad_screen_buffer_t &&buffer) {
+  auto const capacity = buffer.capacity();
+  // too large to ever be pooled, it mustn't evict what is
+  if (capacity == 0 || capacity > details::MaxPooledBytes)
+    return;
+
+  std::lock_guard<std::mutex> lock{m_mutex};
+  // when full, make room by dropping the smallest buffers first
+  while (!m_buffers.empty() &&
+         (m_buffers.size() >= details::MaxPooledBuffers ||
+          m_pooledBytes + capacity > details::MaxPooledBytes)) {
+    m_pooledBytes -= m_buffers.begin()->first;
+    m_buffers.erase(m_buffers.begin());
+  }
+  m_pooledBytes += capacity;
+  m_buffers.emplace(capacity, std::move(buffer));
+}
+
+std::shared_ptr<image_data_t> make_pooled_image() {
+  auto image = new image_data_t{};
+  return std::shared_ptr<image_data_t>(image, [](image_data_t *image) {
+    buffer_pool_t::instance().release(std::move(image->buffer));
+    delete image;
+  });
+}
+
+void ensure_buffer_size(qad_screen_buffer_t &buffer, std::size_t const size) {
+  if (buffer.capacity() < size) {
+    auto &pool = buffer_pool_t::instance();
+    pool.release(std::move(buffer));
+    buffer = pool.acquire_empty(size);
+  }
+  buffer.resize(size);
+}
+} // namespace qadx
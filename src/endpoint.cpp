@@ -83,9 +83,14 @@ void endpoint_t::construct_special_placeholder(
       placeholder.suffix.pop_back();
   }
 
-  if (m_specialEndpoints.find(prefix) != m_specialEndpoints.end())
-    throw std::runtime_error("the prefix '" + prefix + "' already exist");
-  m_specialEndpoints[prefix] = std::move(placeholder);
+  auto const [first, last] = m_specialEndpoints.equal_range(prefix);
+  for (auto iter = first; iter != last; ++iter) {
+    auto const &existing = iter->second;
+    if (existing.suffix == placeholder.suffix &&
+        existing.placeholders.size() == placeholder.placeholders.size())
+      throw std::runtime_error("the route '" + route + "' already exist");
+  }
+  m_specialEndpoints.emplace(prefix, std::move(placeholder));
 }
 
 std::optional<endpoint_t::special_placeholders_t>
@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frame_archive.hpp"
+#include "enumerations.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+namespace qadx {
+frame_archive_t *
+frame_archive_t::create_global_instance(std::string const &directory) {
+  static std::unique_ptr<frame_archive_t> instance(
+      new frame_archive_t(directory));
+  return instance.get();
+}
+
+std::string frame_archive_t::frame_id(uint64_t const hash) {
+  return fmt::format("{:016x}", hash);
+}
+
+std::filesystem::path
+frame_archive_t::path_of(std::string const &frame_id) const {
+  // fan out over 256 sub-directories, the archive gets large
+  return m_directory / frame_id.substr(0, 2) / (frame_id + ".png");
+}
+
+bool frame_archive_t::contains(uint64_t const hash) const {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (m_known.count(hash) != 0)
+      return true;
+  }
+  std::error_code ec{};
+  if (!std::filesystem::exists(path_of(frame_id(hash)), ec))
+    return false;
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_known.insert(hash);
+  return true;
+}
+
+std::string frame_archive_t::store(uint64_t const hash,
+                                   raw_frame_t const &frame,
+                                   image_data_t const *encoded) {
+  auto const id = frame_id(hash);
+  if (contains(hash))
+    return id;
+
+  image_data_t png{};
+  if (encoded && encoded->type == image_type_e::bmp && frame.data.empty()) {
+    // the backend encoded straight from its own buffer, the BMP has the
+    // only copy of the pixels: 32bpp B, G, R, X rows, bottom-up
+    BMPHeader header{};
+    memcpy(&header, encoded->buffer.data(), sizeof header);
+    auto const stride = header.width * 4;
+    auto last_row = const_cast<unsigned char *>(encoded->buffer.data()) +
+                    header.offset + (size_t)stride * (header.height - 1);
+    write_png(last_row, header.width, header.height, -stride, 32, 0, png);
+    encoded = &png;
+  } else if (!encoded || encoded->type != image_type_e::png) {
+    write_png(const_cast<unsigned char *>(frame.data.data()), frame.width,
+              frame.height, frame.stride, frame.bpp, frame.rgb, png);
+    encoded = &png;
+  }
+
+  // written aside and renamed, readers never see a partial frame. The lock
+  // is only held for m_known: requests storing the same new frame at once
+  // each write their own copy, and the last rename wins
+  auto const path = path_of(id);
+  auto const temp_path = fmt::format("{}.{}.tmp", path.string(), ++m_nextTemp);
+  std::error_code ec{};
+  std::filesystem::create_directories(path.parent_path(), ec);
+  {
+    std::ofstream out_file(temp_path, std::ios::out | std::ios::binary);
+    out_file.write(reinterpret_cast<char const *>(encoded->buffer.data()),
+                   encoded->buffer.size());
+    if (!out_file) {
+      spdlog::error("unable to archive frame {} to {}", id, temp_path);
+      std::filesystem::remove(temp_path, ec);
+      return {};
+    }
+  }
+  std::filesystem::rename(temp_path, path, ec);
+  if (ec) {
+    spdlog::error("unable to archive frame {}: {}", id, ec.message());
+    std::filesystem::remove(temp_path, ec);
+    return {};
+  }
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_known.insert(hash);
+  return id;
+}
+
+std::optional<std::filesystem::path>
+frame_archive_t::find(std::string const &frame_id) const {
+  if (frame_id.size() != 16 ||
+      frame_id.find_first_not_of("0123456789abcdef") != std::string::npos)
+    return std::nullopt;
+  auto path = path_of(frame_id);
+  std::error_code ec{};
+  if (!std::filesystem::is_regular_file(path, ec))
+    return std::nullopt;
+  return path;
+}
+} // namespace qadx
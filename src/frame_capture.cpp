@@ -0,0 +1,560 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frame_capture.hpp"
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <deque>
+#include <spdlog/spdlog.h>
+
+namespace qadx {
+namespace {
+// how long the grabs of a background capture may keep failing before it
+// gives up on the screen
+constexpr auto max_failing_time = std::chrono::seconds(5);
+} // namespace
+
+boost::asio::thread_pool &capture_pool() {
+  static boost::asio::thread_pool pool{
+      std::max(2u, std::thread::hardware_concurrency())};
+  return pool;
+}
+
+frame_ring_t::frame_ring_t(std::size_t const capacity)
+    : m_slots(std::max<std::size_t>(capacity, 2)) {}
+
+std::shared_ptr<captured_frame_t> frame_ring_t::acquire_slot() {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto &slot = m_slots[m_next];
+  m_next = (m_next + 1) % m_slots.size();
+  // a slot still referenced by a reader is left to it, and replaced
+  if (!slot || slot.use_count() > 1)
+    slot = std::make_shared<captured_frame_t>();
+  return slot;
+}
+
+void frame_ring_t::publish(std::shared_ptr<captured_frame_t> const &frame) {
+  std::vector<frame_callback_t> ready{};
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    // a capture that was just stopped may still be finishing a frame
+    if (!m_active)
+      return;
+    frame->sequence = ++m_sequence;
+    frame->timestamp = std::chrono::system_clock::now();
+    frame->encoding = std::make_shared<frame_encoding_t>();
+    m_newest = frame;
+
+    auto iter = m_waiters.begin();
+    while (iter != m_waiters.end()) {
+      if (iter->sequence < frame->sequence) {
+        ready.push_back(std::move(iter->callback));
+        iter = m_waiters.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+  for (auto const &callback : ready)
+    callback(frame);
+}
+
+void frame_ring_t::expire_waiters() {
+  std::vector<frame_callback_t> expired{};
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto const now = std::chrono::steady_clock::now();
+    auto iter = m_waiters.begin();
+    while (iter != m_waiters.end()) {
+      if (iter->deadline <= now) {
+        expired.push_back(std::move(iter->callback));
+        iter = m_waiters.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+  for (auto const &callback : expired)
+    callback(nullptr);
+}
+
+captured_frame_ptr frame_ring_t::newest() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_newest;
+}
+
+void frame_ring_t::set_active(bool const active) {
+  std::vector<waiter_t> waiters{};
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_active = active;
+    if (active)
+      return;
+    // sequence numbers carry on, so a client's `after` stays meaningful
+    // when the screen is captured again later
+    m_newest = nullptr;
+    waiters.swap(m_waiters);
+  }
+  for (auto const &waiter : waiters)
+    waiter.callback(nullptr);
+}
+
+void frame_ring_t::when_newer_than(
+    uint64_t const sequence, std::chrono::steady_clock::duration const timeout,
+    frame_callback_t callback) {
+  std::unique_lock<std::mutex> lock{m_mutex};
+  if (!m_active) {
+    lock.unlock();
+    return callback(nullptr);
+  }
+  if (m_newest && m_newest->sequence > sequence) {
+    captured_frame_ptr frame = m_newest;
+    lock.unlock();
+    return callback(std::move(frame));
+  }
+  m_waiters.push_back(
+      {sequence, std::chrono::steady_clock::now() + timeout,
+       std::move(callback)});
+}
+
+void encode_captured_frame(captured_frame_ptr const &frame,
+                           frame_archive_t *const archive,
+                           encoded_frame_callback_t callback) {
+  auto &encoding = *frame->encoding;
+  {
+    std::unique_lock<std::mutex> lock{encoding.mutex};
+    if (encoding.done) {
+      auto image = encoding.image;
+      auto const frame_id = encoding.frame_id;
+      lock.unlock();
+      return callback(std::move(image), frame_id);
+    }
+    encoding.waiters.push_back(std::move(callback));
+    if (encoding.started)
+      return;
+    encoding.started = true;
+  }
+
+  // the worker holds on to the frame, so its slot isn't reused meanwhile
+  boost::asio::post(capture_pool(), [frame, archive] {
+    std::shared_ptr<image_data_t> image = nullptr;
+    std::string frame_id{};
+    auto const &raw = frame->frame;
+    try {
+      auto encoded = make_pooled_image();
+      write_png(const_cast<unsigned char *>(raw.data.data()), raw.width,
+                raw.height, raw.stride, raw.bpp, raw.rgb, *encoded);
+      image = std::move(encoded);
+    } catch (std::exception const &e) {
+      spdlog::error("encoding frame {}: {}", frame->sequence, e.what());
+    }
+    if (archive) {
+      try {
+        frame_id = archive->store(frame->hash, raw, image.get());
+      } catch (std::exception const &e) {
+        spdlog::error("archiving frame {}: {}", frame->sequence, e.what());
+      }
+    }
+
+    auto &encoding = *frame->encoding;
+    std::vector<encoded_frame_callback_t> waiters{};
+    {
+      std::lock_guard<std::mutex> lock{encoding.mutex};
+      encoding.done = true;
+      encoding.image = image;
+      encoding.frame_id = frame_id;
+      waiters.swap(encoding.waiters);
+    }
+    for (auto const &waiter : waiters)
+      waiter(image, frame_id);
+  });
+}
+
+char const *to_string(capture_policy_e const policy) {
+  switch (policy) {
+  case capture_policy_e::periodic:
+    return "periodic";
+  case capture_policy_e::change_triggered:
+    return "change-triggered";
+  default:
+    return "on-demand";
+  }
+}
+
+std::optional<capture_policy_e> to_capture_policy(std::string const &name) {
+  if (name == "on-demand")
+    return capture_policy_e::on_demand;
+  if (name == "periodic")
+    return capture_policy_e::periodic;
+  if (name == "change-triggered")
+    return capture_policy_e::change_triggered;
+  return std::nullopt;
+}
+
+screen_capture_t::screen_capture_t(base_screen_t *screen, int const screen_id,
+                                   capture_policy_t const &policy,
+                                   std::shared_ptr<frame_ring_t> ring)
+    : m_screen(screen), m_screenId(screen_id), m_policy(policy.policy),
+      m_interval(std::chrono::microseconds(1'000'000 / policy.fps)),
+      m_ring(std::move(ring)), m_thread([this] { capture_loop(); }) {}
+
+screen_capture_t::~screen_capture_t() {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stopped = true;
+  }
+  m_stopCondition.notify_all();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void screen_capture_t::capture_loop() {
+  spdlog::info("Capturing screen {} in the background ({})", m_screenId,
+               to_string(m_policy));
+  bool const change_triggered =
+      m_policy == capture_policy_e::change_triggered;
+  std::optional<uint64_t> last_token{};
+  auto next_capture = std::chrono::steady_clock::now();
+  // when the grabs started failing, if the last one did
+  std::optional<std::chrono::steady_clock::time_point> failing_since{};
+  while (!m_stopped) {
+    bool grabbed = true;
+    try {
+      // without a token from the backend every check is a capture
+      std::optional<uint64_t> token{};
+      if (change_triggered)
+        token = m_screen->frame_token(m_screenId);
+      if (!token || !last_token || *token != *last_token) {
+        auto slot = m_ring->acquire_slot();
+        grabbed = m_screen->grab_raw_frame(slot->frame, m_screenId);
+        if (grabbed) {
+          slot->hash = hash_frame(slot->frame);
+          m_ring->publish(slot);
+          last_token = token;
+        }
+      }
+    } catch (std::exception const &e) {
+      spdlog::error("background capture of screen {}: {}", m_screenId,
+                    e.what());
+      grabbed = false;
+    }
+    m_ring->expire_waiters();
+
+    auto const now = std::chrono::steady_clock::now();
+    if (grabbed) {
+      failing_since.reset();
+    } else if (!failing_since) {
+      failing_since = now;
+    } else if (now - *failing_since >= max_failing_time) {
+      spdlog::error("Stopped capturing screen {}, its grabs keep failing",
+                    m_screenId);
+      m_failed = true;
+      m_ring->set_active(false);
+      return;
+    }
+
+    // keep a fixed rate, without bursts to catch up on a slow capture
+    next_capture += m_interval;
+    if (next_capture < now)
+      next_capture = now;
+    std::unique_lock<std::mutex> lock{m_mutex};
+    m_stopCondition.wait_until(lock, next_capture,
+                               [this] { return m_stopped.load(); });
+  }
+}
+
+capture_service_t *capture_service_t::create_global_instance(
+    base_screen_t *screen, capture_policy_t const &default_policy,
+    std::size_t const ring_size) {
+  static std::unique_ptr<capture_service_t> instance(
+      new capture_service_t(screen, default_policy, ring_size));
+  return instance.get();
+}
+
+capture_service_t::screen_state_t *
+capture_service_t::screen_state(int const screen_id) {
+  auto iter = m_screens.find(screen_id);
+  if (iter == m_screens.end()) {
+    auto const ids = m_screen->screen_ids();
+    if (std::find(ids.cbegin(), ids.cend(), screen_id) == ids.cend())
+      return nullptr;
+    iter = m_screens.emplace(screen_id, screen_state_t{}).first;
+    iter->second.policy = m_defaultPolicy;
+    iter->second.ring = std::make_shared<frame_ring_t>(m_ringSize);
+  }
+  return &iter->second;
+}
+
+std::shared_ptr<frame_ring_t> capture_service_t::ring(int const screen_id) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto state = screen_state(screen_id);
+  if (!state || state->policy.policy == capture_policy_e::on_demand)
+    return nullptr;
+  if (state->capture && state->capture->failed()) {
+    // its thread has returned already, joining it doesn't wait. The screen
+    // may have gone for good, in which case it's forgotten
+    state->capture.reset();
+    auto const ids = m_screen->screen_ids();
+    if (std::find(ids.cbegin(), ids.cend(), screen_id) == ids.cend()) {
+      m_screens.erase(screen_id);
+      return nullptr;
+    }
+  }
+  if (!state->capture) {
+    state->ring->set_active(true);
+    state->capture = std::make_unique<screen_capture_t>(
+        m_screen, screen_id, state->policy, state->ring);
+  }
+  return state->ring;
+}
+
+std::optional<capture_policy_t>
+capture_service_t::policy(int const screen_id) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto state = screen_state(screen_id);
+  if (!state)
+    return std::nullopt;
+  return state->policy;
+}
+
+bool capture_service_t::set_policy(int const screen_id,
+                                   capture_policy_t const &policy) {
+  std::unique_ptr<screen_capture_t> previous{};
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto state_ptr = screen_state(screen_id);
+    if (!state_ptr)
+      return false;
+    auto &state = *state_ptr;
+    state.policy = policy;
+    previous = std::move(state.capture);
+    if (policy.policy == capture_policy_e::on_demand) {
+      state.ring->set_active(false);
+    } else {
+      // the newest frame of the previous policy is served until the new
+      // capture publishes its first one
+      state.ring->set_active(true);
+      state.capture = std::make_unique<screen_capture_t>(
+          m_screen, screen_id, policy, state.ring);
+    }
+  }
+  // joining the capture thread can take up to one interval, which is better
+  // not spent holding the lock
+  previous.reset();
+  spdlog::info("Capture policy of screen {} set to {}", screen_id,
+               to_string(policy.policy));
+  return true;
+}
+
+namespace {
+std::atomic_int g_runningBursts{0};
+// raw frames of a burst waiting for the encoder, beyond which the capture
+// waits for it
+constexpr std::size_t max_pending_burst_frames = 2;
+} // namespace
+
+bool capture_burst(base_screen_t *screen, int const screen_id, int const count,
+                   std::chrono::milliseconds const interval,
+                   burst_callback_t callback) {
+  // each burst holds two threads for as long as it lasts
+  if (++g_runningBursts > max_concurrent_bursts) {
+    --g_runningBursts;
+    return false;
+  }
+  std::thread([=, callback = std::move(callback)] {
+    std::mutex mutex{};
+    std::condition_variable frame_ready{};
+    std::condition_variable frame_taken{};
+    std::deque<std::pair<burst_frame_t, raw_frame_t>> pending{};
+    bool capture_done = false;
+    std::atomic_bool failed = false;
+    std::vector<burst_frame_t> frames{};
+    frames.reserve(count);
+
+    // the raw frames are released as soon as they're encoded, and only a few
+    // wait for the encoder, so long bursts of large screens don't pile up in
+    // memory when encoding is slower than the interval
+    std::thread encoder([&] {
+      while (true) {
+        std::unique_lock<std::mutex> lock{mutex};
+        frame_ready.wait(lock, [&] { return capture_done || !pending.empty(); });
+        if (pending.empty())
+          return;
+        auto [frame, raw] = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+        frame_taken.notify_one();
+        try {
+          frame.image = make_pooled_image();
+          screen->encode_raw_frame(raw, *frame.image);
+          frames.push_back(std::move(frame));
+        } catch (std::exception const &e) {
+          spdlog::error("burst of screen {}: {}", screen_id, e.what());
+          failed = true;
+        }
+        buffer_pool_t::instance().release(std::move(raw.data));
+      }
+    });
+
+    // every frame is scheduled from the start of the burst, a slow capture
+    // delays the one after it but the error doesn't accumulate
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count && !failed; ++i) {
+      std::this_thread::sleep_until(start + i * interval);
+      burst_frame_t frame{};
+      raw_frame_t raw{};
+      try {
+        if (!screen->grab_raw_frame(raw, screen_id))
+          failed = true;
+      } catch (std::exception const &e) {
+        spdlog::error("burst of screen {}: {}", screen_id, e.what());
+        failed = true;
+      }
+      if (failed) {
+        buffer_pool_t::instance().release(std::move(raw.data));
+        break;
+      }
+      // when the frame was actually grabbed, rather than when it was due
+      frame.timestamp = std::chrono::system_clock::now();
+      frame.offset = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+      frame.hash = hash_frame(raw);
+      {
+        // delays the next grab, whose offset tells when it really happened
+        std::unique_lock<std::mutex> lock{mutex};
+        frame_taken.wait(lock, [&] {
+          return pending.size() < max_pending_burst_frames;
+        });
+        pending.emplace_back(std::move(frame), std::move(raw));
+      }
+      frame_ready.notify_one();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      capture_done = true;
+    }
+    frame_ready.notify_one();
+    encoder.join();
+    if (failed)
+      frames.clear();
+    --g_runningBursts;
+    callback(std::move(frames));
+  }).detach();
+  return true;
+}
+namespace {
+struct screens_capture_t {
+  base_screen_t *screen = nullptr;
+  bool encode = false;
+  std::vector<int> screen_ids{};
+  std::vector<screen_frame_t> frames{};
+  std::atomic_int remaining = 0;
+  std::chrono::steady_clock::time_point start{};
+  screens_callback_t callback;
+};
+
+// hashes and encodes one grabbed frame, the last one done hands them all over
+void finish_screen_frame(std::shared_ptr<screens_capture_t> const &capture,
+                         std::size_t const index) {
+  auto &frame = capture->frames[index];
+  frame.captured = !frame.frame.data.empty();
+  if (frame.captured) {
+    frame.hash = hash_frame(frame.frame);
+    if (capture->encode) {
+      try {
+        capture->screen->encode_raw_frame(frame.frame, frame.image);
+        buffer_pool_t::instance().release(std::move(frame.frame.data));
+      } catch (std::exception const &e) {
+        spdlog::error("capture of screen {}: {}", frame.screen_id, e.what());
+        frame.captured = false;
+      }
+    }
+  }
+  if (--capture->remaining == 0)
+    capture->callback(std::move(capture->frames));
+}
+} // namespace
+
+void capture_screens(base_screen_t *screen, std::vector<int> screen_ids,
+                     bool const encode, screens_callback_t callback) {
+  auto capture = std::make_shared<screens_capture_t>();
+  capture->screen = screen;
+  capture->encode = encode;
+  capture->frames.resize(screen_ids.size());
+  for (std::size_t i = 0; i < screen_ids.size(); ++i)
+    capture->frames[i].screen_id = screen_ids[i];
+  capture->screen_ids = std::move(screen_ids);
+  capture->remaining = (int)capture->frames.size();
+  capture->callback = std::move(callback);
+  if (capture->frames.empty())
+    return capture->callback({});
+
+  auto &pool = capture_pool();
+  capture->start = std::chrono::steady_clock::now();
+  if (screen->concurrent_grabs()) {
+    for (std::size_t i = 0; i < capture->frames.size(); ++i) {
+      boost::asio::post(pool, [capture, i] {
+        auto &frame = capture->frames[i];
+        frame.timestamp = std::chrono::system_clock::now();
+        frame.offset = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - capture->start);
+        try {
+          if (!capture->screen->grab_raw_frame(frame.frame, frame.screen_id))
+            frame.frame.data.clear();
+        } catch (std::exception const &e) {
+          spdlog::error("capture of screen {}: {}", frame.screen_id, e.what());
+          frame.frame.data.clear();
+        }
+        finish_screen_frame(capture, i);
+      });
+    }
+    return;
+  }
+
+  // the backend grabs every screen in one go, so the frames share the time
+  // that grab started at, as the concurrent grabs above each report theirs
+  boost::asio::post(pool, [capture, &pool] {
+    auto const timestamp = std::chrono::system_clock::now();
+    auto const offset = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - capture->start);
+    std::vector<raw_frame_t> raw_frames{};
+    try {
+      capture->screen->grab_raw_frames(capture->screen_ids, raw_frames);
+    } catch (std::exception const &e) {
+      spdlog::error("capture of screens: {}", e.what());
+    }
+    raw_frames.resize(capture->frames.size());
+    for (std::size_t i = 0; i < capture->frames.size(); ++i) {
+      auto &frame = capture->frames[i];
+      frame.frame = std::move(raw_frames[i]);
+      frame.timestamp = timestamp;
+      frame.offset = offset;
+      boost::asio::post(pool, [capture, i] { finish_screen_frame(capture, i); });
+    }
+  });
+}
+} // namespace qadx
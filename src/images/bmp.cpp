@@ -28,10 +28,8 @@
 #include <cstring>
 
 namespace qadx {
-// Write BMP file from image buffer
-int encode_bmp(qad_screen_buffer_t const &raw_image_buffer, int const width,
-               int const height, int const stride, image_data_t &image_data) {
-
+unsigned char *begin_bmp(int const width, int const height, int const stride,
+                         image_data_t &image_data) {
   BMPHeader header{};
   header.type = 0x4D42;
   header.size = sizeof(BMPHeader) + stride * height;
@@ -51,15 +49,20 @@ int encode_bmp(qad_screen_buffer_t const &raw_image_buffer, int const width,
   header.important_colors = 0;
 
   auto const buffer_size = sizeof header + header.image_size;
-  image_data.buffer.resize(buffer_size);
+  ensure_buffer_size(image_data.buffer, buffer_size);
   image_data.type = image_type_e::bmp;
 
   unsigned char *out = image_data.buffer.data();
   memcpy(out, &header, sizeof header);
-  out += sizeof header;
+  return out + sizeof header;
+}
 
+// Write BMP file from image buffer
+int encode_bmp(qad_screen_buffer_t const &raw_image_buffer, int const width,
+               int const height, int const stride, image_data_t &image_data) {
+  auto out = begin_bmp(width, height, stride, image_data);
   // Write data to image
-  memcpy(out, raw_image_buffer.data(), header.image_size);
+  memcpy(out, raw_image_buffer.data(), (size_t)stride * height);
   return 0;
 }
 
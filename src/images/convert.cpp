@@ -0,0 +1,178 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "image.hpp"
+#include "drm_fourcc.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace qadx {
+namespace {
+// Every pixel format is a traits type with the storage of one pixel and its
+// conversion to 0x00RRGGBB, which little endian stores as B, G, R, X. The
+// row loop is instantiated once per format, so the compiler gets to inline
+// and vectorise each conversion.
+struct xbgr8888_t {
+  using storage_t = uint32_t;
+  static uint32_t to_xrgb(uint32_t const p) {
+    return ((p & 0xffu) << 16) | (p & 0xff00u) | ((p >> 16) & 0xffu);
+  }
+};
+
+struct rgb565_t {
+  using storage_t = uint16_t;
+  static uint32_t to_xrgb(uint16_t const p) {
+    // the high bits are repeated into the low ones so that full intensity
+    // stays 0xff
+    uint32_t const r = (p >> 11) & 0x1fu;
+    uint32_t const g = (p >> 5) & 0x3fu;
+    uint32_t const b = p & 0x1fu;
+    return (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) |
+           ((b << 3) | (b >> 2));
+  }
+};
+
+// 10-bit channels keep their 8 most significant bits
+struct xrgb2101010_t {
+  using storage_t = uint32_t;
+  static uint32_t to_xrgb(uint32_t const p) {
+    return (((p >> 22) & 0xffu) << 16) | (((p >> 12) & 0xffu) << 8) |
+           ((p >> 2) & 0xffu);
+  }
+};
+
+struct xbgr2101010_t {
+  using storage_t = uint32_t;
+  static uint32_t to_xrgb(uint32_t const p) {
+    return (((p >> 2) & 0xffu) << 16) | (((p >> 12) & 0xffu) << 8) |
+           ((p >> 22) & 0xffu);
+  }
+};
+
+template <typename format_t>
+void convert_packed(frame_plane_t const *planes, int const width,
+                    int const height, raw_frame_t &frame) {
+  using storage_t = typename format_t::storage_t;
+  auto const &plane = planes[0];
+  auto const source = static_cast<unsigned char const *>(plane.data);
+  for (int y = 0; y < height; ++y) {
+    auto const row =
+        reinterpret_cast<storage_t const *>(source + (size_t)y * plane.pitch);
+    auto const out = reinterpret_cast<uint32_t *>(frame.data.data() +
+                                                  (size_t)y * frame.stride);
+    for (int x = 0; x < width; ++x)
+      out[x] = format_t::to_xrgb(row[x]);
+  }
+}
+
+void copy_rows(frame_plane_t const *planes, int const width, int const height,
+               raw_frame_t &frame) {
+  auto const &plane = planes[0];
+  auto const source = static_cast<unsigned char const *>(plane.data);
+  auto const row_size = (size_t)width * 4;
+  if ((size_t)plane.pitch == row_size) {
+    memcpy(frame.data.data(), source, row_size * height);
+    return;
+  }
+  for (int y = 0; y < height; ++y) {
+    memcpy(frame.data.data() + (size_t)y * frame.stride,
+           source + (size_t)y * plane.pitch, row_size);
+  }
+}
+
+inline uint32_t clamp_channel(int const value) {
+  return (uint32_t)std::clamp(value, 0, 255);
+}
+
+// BT.601 limited range, the usual one for NV12 scanout, in 8.8 fixed point
+void convert_nv12(frame_plane_t const *planes, int const width,
+                  int const height, raw_frame_t &frame) {
+  auto const luma = static_cast<unsigned char const *>(planes[0].data);
+  auto const chroma = static_cast<unsigned char const *>(planes[1].data);
+  for (int y = 0; y < height; ++y) {
+    auto const y_row = luma + (size_t)y * planes[0].pitch;
+    auto const uv_row = chroma + (size_t)(y / 2) * planes[1].pitch;
+    auto const out = reinterpret_cast<uint32_t *>(frame.data.data() +
+                                                  (size_t)y * frame.stride);
+    for (int x = 0; x < width; ++x) {
+      int const c = 298 * (y_row[x] - 16);
+      int const d = uv_row[x & ~1] - 128;
+      int const e = uv_row[x | 1] - 128;
+      uint32_t const r = clamp_channel((c + 409 * e + 128) >> 8);
+      uint32_t const g = clamp_channel((c - 100 * d - 208 * e + 128) >> 8);
+      uint32_t const b = clamp_channel((c + 516 * d + 128) >> 8);
+      out[x] = (r << 16) | (g << 8) | b;
+    }
+  }
+}
+
+using convert_function_t = void (*)(frame_plane_t const *, int, int,
+                                     raw_frame_t &);
+
+convert_function_t find_converter(uint32_t const format) {
+  switch (format) {
+  case DRM_FORMAT_XRGB8888:
+  case DRM_FORMAT_ARGB8888:
+    return copy_rows;
+  case DRM_FORMAT_XBGR8888:
+  case DRM_FORMAT_ABGR8888:
+    return convert_packed<xbgr8888_t>;
+  case DRM_FORMAT_RGB565:
+    return convert_packed<rgb565_t>;
+  case DRM_FORMAT_XRGB2101010:
+  case DRM_FORMAT_ARGB2101010:
+    return convert_packed<xrgb2101010_t>;
+  case DRM_FORMAT_XBGR2101010:
+  case DRM_FORMAT_ABGR2101010:
+    return convert_packed<xbgr2101010_t>;
+  case DRM_FORMAT_NV12:
+    return convert_nv12;
+  default:
+    return nullptr;
+  }
+}
+} // namespace
+
+bool can_convert_frame(uint32_t const format) {
+  return find_converter(format) != nullptr;
+}
+
+bool convert_frame(uint32_t const format, frame_plane_t const *planes,
+                   int const width, int const height, raw_frame_t &frame) {
+  auto const convert = find_converter(format);
+  if (!convert)
+    return false;
+
+  frame.width = width;
+  frame.height = height;
+  frame.stride = width * 4;
+  frame.bpp = 32;
+  frame.rgb = 0;
+  ensure_buffer_size(frame.data, (size_t)frame.stride * height);
+  convert(planes, width, height, frame);
+  return true;
+}
+} // namespace qadx
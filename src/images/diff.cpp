@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "image.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace qadx {
+namespace details {
+bool tile_is_dirty(raw_frame_t const &previous, raw_frame_t const &current,
+                   int const x, int const y, int const width,
+                   int const height) {
+  auto const bytes_per_pixel = current.bpp / 8;
+  auto const offset = (size_t)x * bytes_per_pixel;
+  auto const row_length = (size_t)width * bytes_per_pixel;
+  for (int row = y; row < y + height; ++row) {
+    auto const row_offset = (size_t)row * current.stride + offset;
+    if (memcmp(previous.data.data() + row_offset,
+               current.data.data() + row_offset, row_length) != 0)
+      return true;
+  }
+  return false;
+}
+} // namespace details
+
+std::vector<frame_rect_t> find_dirty_tiles(raw_frame_t const &previous,
+                                           raw_frame_t const &current,
+                                           int const tile_size) {
+  if (previous.width != current.width || previous.height != current.height ||
+      previous.stride != current.stride || previous.bpp != current.bpp ||
+      previous.data.size() != current.data.size()) {
+    return {{0, 0, current.width, current.height}};
+  }
+
+  std::vector<frame_rect_t> dirty_rects{};
+  for (int y = 0; y < current.height; y += tile_size) {
+    int const height = std::min(tile_size, current.height - y);
+    frame_rect_t *run = nullptr;
+    for (int x = 0; x < current.width; x += tile_size) {
+      int const width = std::min(tile_size, current.width - x);
+      if (!details::tile_is_dirty(previous, current, x, y, width, height)) {
+        run = nullptr;
+        continue;
+      }
+      if (run) {
+        run->width += width;
+      } else {
+        run = &dirty_rects.emplace_back(frame_rect_t{x, y, width, height});
+      }
+    }
+  }
+  return dirty_rects;
+}
+} // namespace qadx
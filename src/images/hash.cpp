@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "image.hpp"
+#include <cstring>
+
+namespace qadx {
+namespace details {
+constexpr uint64_t hash_prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t hash_prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t hash_prime3 = 0x165667B19E3779F9ULL;
+
+inline uint64_t rotate_left(uint64_t const value, int const bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t hash_round(uint64_t const lane, uint64_t const word) {
+  return rotate_left(lane + word * hash_prime2, 31) * hash_prime1;
+}
+} // namespace details
+
+uint64_t hash_frame(raw_frame_t const &frame) {
+  return hash_pixels(frame.data.data(), frame.width, frame.height,
+                     frame.stride, frame.bpp, frame.rgb);
+}
+
+uint64_t hash_pixels(unsigned char const *const pixels, int const width,
+                     int const height, int const stride, int const bpp,
+                     int const rgb) {
+  using namespace details;
+  // four independent lanes over 32-byte blocks: each word only depends on
+  // its own lane, so the CPU can keep four multiplies in flight at once
+  uint64_t lanes[4] = {hash_prime1 + hash_prime2, hash_prime2, 0,
+                       0 - hash_prime1};
+  auto const row_length = (size_t)width * (bpp / 8);
+  auto const block_end = row_length & ~(size_t)31;
+  uint64_t tail = 0;
+
+  // only the visible part of each row, the padding up to the stride is
+  // left as whatever the driver had in it
+  for (int row = 0; row < height; ++row) {
+    auto const *p = pixels + (size_t)row * stride;
+    for (size_t i = 0; i < block_end; i += 32) {
+      uint64_t words[4];
+      memcpy(words, p + i, sizeof words);
+      for (int lane = 0; lane < 4; ++lane)
+        lanes[lane] = hash_round(lanes[lane], words[lane]);
+    }
+    for (size_t i = block_end; i < row_length; ++i)
+      tail = hash_round(tail, p[i]);
+  }
+
+  uint64_t hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) +
+                  rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+  hash ^= hash_round(0, tail);
+  hash ^= hash_round(0, ((uint64_t)width << 32) | (uint32_t)height);
+  hash ^= hash_round(0, ((uint64_t)bpp << 8) | (uint64_t)rgb);
+  hash ^= hash >> 33;
+  hash *= hash_prime2;
+  hash ^= hash >> 29;
+  hash *= hash_prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+} // namespace qadx
@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "enumerations.hpp"
+#include "image.hpp"
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#include <stdexcept>
+
+namespace qadx {
+namespace details {
+enum { JpegChunkSize = 64 * 1'024 };
+
+struct jpeg_error_manager_t {
+  jpeg_error_mgr pub{};
+  std::jmp_buf jump_buffer{};
+};
+
+struct jpeg_destination_t {
+  jpeg_destination_mgr pub{};
+  image_data_t *image = nullptr;
+};
+
+void jpeg_error_exit(j_common_ptr cinfo) {
+  auto error = reinterpret_cast<jpeg_error_manager_t *>(cinfo->err);
+  std::longjmp(error->jump_buffer, 1);
+}
+
+// the encoded image is written straight into image_data_t::buffer, which is
+// grown in chunks rather than once per libjpeg callback
+void jpeg_init_destination(j_compress_ptr cinfo) {
+  auto dest = reinterpret_cast<jpeg_destination_t *>(cinfo->dest);
+  auto &buffer = dest->image->buffer;
+  buffer.resize(std::max<size_t>(buffer.capacity(), JpegChunkSize));
+  dest->pub.next_output_byte = buffer.data();
+  dest->pub.free_in_buffer = buffer.size();
+}
+
+boolean jpeg_empty_output_buffer(j_compress_ptr cinfo) {
+  auto dest = reinterpret_cast<jpeg_destination_t *>(cinfo->dest);
+  auto &buffer = dest->image->buffer;
+  auto const old_size = buffer.size();
+  buffer.resize(old_size * 2);
+  dest->pub.next_output_byte = buffer.data() + old_size;
+  dest->pub.free_in_buffer = buffer.size() - old_size;
+  return TRUE;
+}
+
+void jpeg_term_destination(j_compress_ptr cinfo) {
+  auto dest = reinterpret_cast<jpeg_destination_t *>(cinfo->dest);
+  auto &buffer = dest->image->buffer;
+  buffer.resize(buffer.size() - dest->pub.free_in_buffer);
+}
+
+J_COLOR_SPACE jpeg_colour_space(int const bpp, int const rgb) {
+  if (bpp == 32)
+    return rgb ? JCS_EXT_RGBX : JCS_EXT_BGRX;
+  if (bpp == 24)
+    return rgb ? JCS_EXT_RGB : JCS_EXT_BGR;
+  throw std::runtime_error("unsupported bits per pixel for JPEG");
+}
+} // namespace details
+
+void write_jpeg(raw_frame_t const &frame, int const quality,
+                image_data_t &screen_buffer) {
+  jpeg_compress_struct cinfo{};
+  details::jpeg_error_manager_t error_manager{};
+  details::jpeg_destination_t destination{};
+  auto const colour_space = details::jpeg_colour_space(frame.bpp, frame.rgb);
+
+  cinfo.err = jpeg_std_error(&error_manager.pub);
+  error_manager.pub.error_exit = details::jpeg_error_exit;
+  if (setjmp(error_manager.jump_buffer)) {
+    jpeg_destroy_compress(&cinfo);
+    throw std::runtime_error("unable to encode JPEG image");
+  }
+
+  jpeg_create_compress(&cinfo);
+  destination.image = &screen_buffer;
+  destination.pub.init_destination = details::jpeg_init_destination;
+  destination.pub.empty_output_buffer = details::jpeg_empty_output_buffer;
+  destination.pub.term_destination = details::jpeg_term_destination;
+  cinfo.dest = &destination.pub;
+
+  cinfo.image_width = frame.width;
+  cinfo.image_height = frame.height;
+  cinfo.input_components = frame.bpp / 8;
+  cinfo.in_color_space = colour_space;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.dct_method = JDCT_IFAST;
+
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    auto row = const_cast<JSAMPROW>(frame.data.data() +
+                                    cinfo.next_scanline * frame.stride);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  screen_buffer.type = image_type_e::jpeg;
+}
+
+} // namespace qadx
@@ -25,6 +25,7 @@
 
 #include "enumerations.hpp"
 #include "image.hpp"
+#include <cstdlib>
 #include <cstring>
 #include <png.h>
 #include <stdexcept>
@@ -32,12 +33,8 @@
 namespace qadx {
 void write_png_func(png_structp png_ptr, png_bytep data, png_size_t length) {
   auto foo = (image_data_t *)png_get_io_ptr(png_ptr);
-  auto &buffer = foo->buffer;
-  size_t const buffer_size = buffer.size();
-  size_t const new_size = buffer_size + length;
-
-  buffer.resize(new_size);
-  memcpy(buffer.data() + buffer_size, data, length);
+  // the buffer was reserved up front, this rarely has to grow it
+  foo->buffer.insert(foo->buffer.end(), data, data + length);
 }
 
 void write_png(void *ptr, int const width, int const height, int const pitch,
@@ -49,6 +46,16 @@ void write_png(void *ptr, int const width, int const height, int const pitch,
   if (setjmp(png_jmpbuf(png_ptr)))
     throw std::runtime_error("unable to do setjmp");
 
+  // a screen compresses well, a quarter of its raw size is usually plenty
+  auto &buffer = screen_buffer.buffer;
+  buffer.clear();
+  if (auto const estimate = (size_t)std::abs(pitch) * height / 4;
+      buffer.capacity() < estimate) {
+    auto &pool = buffer_pool_t::instance();
+    pool.release(std::move(buffer));
+    buffer = pool.acquire_empty(estimate);
+  }
+
   png_set_compression_level(png_ptr, 1);
   png_set_write_fn(png_ptr, &screen_buffer, write_png_func, nullptr);
 
@@ -58,7 +65,8 @@ void write_png(void *ptr, int const width, int const height, int const pitch,
                PNG_FILTER_TYPE_DEFAULT);
   png_write_info(png_ptr, png_info_ptr);
 
-  // TODO: Big assumption
+  // backends hand over 32bpp pixels, anything else scanned out is converted
+  // first (see convert_frame)
   if (bpp == 32) {
     if (!rgb)
       png_set_bgr(png_ptr);
@@ -84,4 +92,23 @@ void write_png(void *ptr, int const width, int const height, int const pitch,
   screen_buffer.type = image_type_e::png;
 }
 
-} // namespace qadx
\ No newline at end of file
+bool read_png(std::string const &path, raw_frame_t &frame) {
+  png_image image{};
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, path.c_str()))
+    return false;
+
+  image.format = PNG_FORMAT_BGRA;
+  frame.width = (int)image.width;
+  frame.height = (int)image.height;
+  frame.stride = (int)PNG_IMAGE_ROW_STRIDE(image);
+  frame.bpp = 32;
+  frame.rgb = 0;
+  ensure_buffer_size(frame.data, PNG_IMAGE_SIZE(image));
+  if (!png_image_finish_read(&image, nullptr, frame.data.data(), 0, nullptr)) {
+    png_image_free(&image);
+    return false;
+  }
+  return true;
+}
+} // namespace qadx
@@ -0,0 +1,178 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "mjpeg_session.hpp"
+#include "frame_capture.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/http/write.hpp>
+#include <spdlog/spdlog.h>
+
+#include <array>
+
+#define MJPEG_BOUNDARY "qadxframe"
+
+namespace qadx {
+mjpeg_session_t::mjpeg_session_t(beast::tcp_stream &&stream,
+                                 base_screen_t *screen, int const screen_id,
+                                 int const fps, int const quality)
+    : m_tcpStream(std::move(stream)), m_timer(m_tcpStream.get_executor()),
+      m_screen(screen), m_screenId(screen_id), m_quality(quality),
+      m_interval(std::chrono::microseconds(1'000'000 / fps)) {}
+
+mjpeg_session_t::~mjpeg_session_t() {
+  spdlog::info("MJPEG stream of screen {} ended: {} frames sent, {} dropped",
+               m_screenId, m_framesSent, m_framesDropped);
+}
+
+void mjpeg_session_t::run(http::request<http::string_body> const &request) {
+  using http::field;
+
+  auto &response = m_headerResponse.emplace(http::status::ok, request.version());
+  response.set(field::server, "qadx-server");
+  response.set(field::content_type,
+               "multipart/x-mixed-replace; boundary=" MJPEG_BOUNDARY);
+  response.set(field::cache_control, "no-cache, no-store, must-revalidate");
+  response.set(field::pragma, "no-cache");
+  response.set(field::connection, "close");
+  response.set(field::access_control_allow_origin, "*");
+  response.set(field::access_control_allow_methods, "GET, POST");
+  response.set(field::access_control_allow_headers,
+               "Content-Type, Authorization");
+
+  m_headerSerializer.emplace(response);
+  beast::get_lowest_layer(m_tcpStream).expires_after(std::chrono::seconds(30));
+  http::async_write_header(
+      m_tcpStream, *m_headerSerializer,
+      [self = shared_from_this()](beast::error_code const ec, std::size_t) {
+        self->on_header_written(ec);
+      });
+}
+
+void mjpeg_session_t::on_header_written(beast::error_code const ec) {
+  m_headerSerializer.reset();
+  m_headerResponse.reset();
+  if (ec) {
+    spdlog::error("unable to start MJPEG stream: {}", ec.message());
+    return shutdown_socket();
+  }
+
+  m_timer.expires_after(std::chrono::steady_clock::duration::zero());
+  m_timer.async_wait(
+      [self = shared_from_this()](beast::error_code const err_c) {
+        self->on_timer_expired(err_c);
+      });
+}
+
+void mjpeg_session_t::schedule_next_frame() {
+  // keep a fixed frame rate, but never try to catch up on missed ticks
+  auto const now = std::chrono::steady_clock::now();
+  auto next_tick = m_timer.expiry() + m_interval;
+  if (next_tick < now)
+    next_tick = now + m_interval;
+  m_timer.expires_at(next_tick);
+  m_timer.async_wait(
+      [self = shared_from_this()](beast::error_code const ec) {
+        self->on_timer_expired(ec);
+      });
+}
+
+void mjpeg_session_t::on_timer_expired(beast::error_code const ec) {
+  if (ec)
+    return;
+
+  if (m_writing) {
+    // the client hasn't consumed the last frame yet, skip this one
+    ++m_framesDropped;
+    return schedule_next_frame();
+  }
+
+  // the grab and the encode happen on a worker, only the write comes back
+  // to the stream; the frame counts as in flight until it's written
+  m_writing = true;
+  net::post(capture_pool(), [self = shared_from_this()] {
+    bool encoded = false;
+    try {
+      encoded = self->m_screen->grab_raw_frame(self->m_rawFrame,
+                                               self->m_screenId);
+      if (encoded)
+        write_jpeg(self->m_rawFrame, self->m_quality, self->m_jpegFrame);
+      else
+        spdlog::error("unable to get frame of screen {}", self->m_screenId);
+    } catch (std::exception const &e) {
+      spdlog::error(e.what());
+      encoded = false;
+    }
+    net::post(self->m_tcpStream.get_executor(),
+              [self, encoded] { self->on_frame_encoded(encoded); });
+  });
+  schedule_next_frame();
+}
+
+void mjpeg_session_t::on_frame_encoded(bool const encoded) {
+  if (!encoded) {
+    m_writing = false;
+    m_timer.cancel();
+    return shutdown_socket();
+  }
+
+  m_partHeader = fmt::format("--" MJPEG_BOUNDARY "\r\n"
+                             "Content-Type: image/jpeg\r\n"
+                             "Content-Length: {}\r\n\r\n",
+                             m_jpegFrame.buffer.size());
+  std::array<net::const_buffer, 3> const buffers{
+      net::buffer(m_partHeader), net::buffer(m_jpegFrame.buffer),
+      net::buffer("\r\n", 2)};
+
+  beast::get_lowest_layer(m_tcpStream).expires_after(std::chrono::seconds(30));
+  net::async_write(
+      m_tcpStream, buffers,
+      [self = shared_from_this()](beast::error_code const err_c, std::size_t) {
+        self->on_frame_written(err_c);
+      });
+}
+
+void mjpeg_session_t::on_frame_written(beast::error_code const ec) {
+  m_writing = false;
+  if (ec) {
+    if (ec != net::error::broken_pipe && ec != net::error::connection_reset)
+      spdlog::error("MJPEG stream write failed: {}", ec.message());
+    m_timer.cancel();
+    return shutdown_socket();
+  }
+  ++m_framesSent;
+}
+
+void mjpeg_session_t::shutdown_socket() {
+  beast::error_code ec{};
+  (void)beast::get_lowest_layer(m_tcpStream)
+      .socket()
+      .shutdown(net::socket_base::shutdown_send, ec);
+  ec = {};
+  (void)beast::get_lowest_layer(m_tcpStream).socket().close(ec);
+  beast::get_lowest_layer(m_tcpStream).close();
+}
+} // namespace qadx
@@ -28,29 +28,108 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/beast/http/read.hpp>
 #include <boost/beast/http/write.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <atomic>
 #include <fstream>
+#include <future>
 #include <spdlog/spdlog.h>
 
 #include "backends/screen/ilm.hpp"
 #include "backends/screen/kms.hpp"
+#include "backends/screen/screencopy.hpp"
+#include "backends/screen/synthetic.hpp"
+#include "mjpeg_session.hpp"
+#include "screenshot_flights.hpp"
 #include "string_utils.hpp"
+#include "websocket_session.hpp"
 
 #define CONTENT_TYPE_JSON "application/json"
 
 namespace qadx {
 enum constant_e { RequestBodySize = 1'024 * 1'024 * 50 };
 
-std::string save_image_to_file(image_data_t const &image) {
-  auto const temp_path =
-      (std::filesystem::temp_directory_path() / get_random_string(25)).string();
-  auto const extension = image.type == image_type_e::png ? "png" : "bmp";
-  auto const filename = fmt::format("{}.{}", temp_path, extension);
-  std::ofstream out_file(filename, std::ios::out | std::ios::binary);
-  if (!out_file)
+char const *image_content_type(image_type_e const type) {
+  switch (type) {
+  case image_type_e::png:
+    return "image/png";
+  case image_type_e::bmp:
+    return "image/bmp";
+  case image_type_e::jpeg:
+    return "image/jpeg";
+  default:
+    return "application/octet-stream";
+  }
+}
+
+// strong entity tags are the frame's content hash, in hex
+std::string entity_tag(uint64_t const hash) {
+  return fmt::format("\"{:016x}\"", hash);
+}
+
+entity_tags_t parse_entity_tags(boost::string_view const header) {
+  entity_tags_t tags{};
+  auto &hashes = tags.hashes;
+  for (auto const &tag : utils::split_string_view(header, ",")) {
+    if (boost::trim_copy(tag) == "*") {
+      tags.any = true;
+      continue;
+    }
+    auto const begin = tag.find('"');
+    auto const end = tag.rfind('"');
+    if (begin == std::string::npos || end <= begin + 1)
+      continue;
+    try {
+      hashes.push_back(
+          std::stoull(tag.substr(begin + 1, end - begin - 1), nullptr, 16));
+    } catch (std::exception const &) {
+    }
+  }
+  return tags;
+}
+
+struct byte_range_t {
+  enum class kind_e { whole, partial, unsatisfiable };
+  kind_e kind = kind_e::whole;
+  uint64_t first = 0;
+  uint64_t last = 0;
+};
+
+// a single "bytes=first-last", "bytes=first-" or "bytes=-suffix" range,
+// clamped to the file. Headers we can't or don't serve, multiple ranges
+// included, are ignored as RFC 7233 asks and yield the whole file; a valid
+// range that doesn't overlap the file is unsatisfiable.
+byte_range_t parse_byte_range(boost::string_view const header,
+                              uint64_t const size) {
+  using kind_e = byte_range_t::kind_e;
+  constexpr boost::string_view unit = "bytes=";
+  if (!boost::starts_with(header, unit))
+    return {};
+  auto const spec = header.substr(unit.size());
+  if (spec.find(',') != boost::string_view::npos)
     return {};
-  out_file.write((char *)image.buffer.data(), image.buffer.size());
-  out_file.close();
-  return filename;
+  auto const dash = spec.find('-');
+  if (dash == boost::string_view::npos)
+    return {};
+  try {
+    auto const first_part = spec.substr(0, dash).to_string();
+    auto const last_part = spec.substr(dash + 1).to_string();
+    if (first_part.empty()) { // the last N bytes
+      uint64_t const suffix = std::stoull(last_part);
+      if (suffix == 0 || size == 0)
+        return {kind_e::unsatisfiable};
+      return {kind_e::partial, size - std::min(suffix, size), size - 1};
+    }
+    uint64_t const first = std::stoull(first_part);
+    uint64_t const last =
+        last_part.empty() ? UINT64_MAX : (uint64_t)std::stoull(last_part);
+    if (last < first)
+      return {};
+    if (first >= size)
+      return {kind_e::unsatisfiable};
+    return {kind_e::partial, first, std::min(last, size - 1)};
+  } catch (std::exception const &) {
+    return {};
+  }
 }
 
 session_t::~session_t() { spdlog::info("Session completed..."); }
@@ -103,7 +182,8 @@ void session_t::handle_requests(string_request_t const &request) {
         std::find(iter.value()->second.verbs.cbegin(), iter_end, method);
     if (found_iter == iter_end)
       return error_handler(method_not_allowed(request));
-    boost::string_view const query_string = split.size() > 1 ? split[1] : "";
+    boost::string_view const query_string =
+        split.size() > 1 ? boost::string_view{split[1]} : boost::string_view{};
     auto url_query{split_optional_queries(query_string)};
     return iter.value()->second.route_callback(url_query);
   }
@@ -121,7 +201,8 @@ void session_t::handle_requests(string_request_t const &request) {
   if (found_iter == rule.verbs.end())
     return error_handler(method_not_allowed(request));
 
-  boost::string_view const query_string = split.size() > 1 ? split[1] : "";
+  boost::string_view const query_string =
+      split.size() > 1 ? boost::string_view{split[1]} : boost::string_view{};
   auto url_query{split_optional_queries(query_string)};
 
   for (auto const &[key, value] : placeholder.placeholders)
@@ -224,17 +305,108 @@ std::shared_ptr<session_t> session_t::add_endpoint_interfaces() {
                            verb::post);
   m_endpoints.add_endpoint("/screen", ROUTE_CALLBACK(screen_request_handler),
                            verb::get);
+  m_endpoints.add_endpoint("/ready", ROUTE_CALLBACK(ready_request_handler),
+                           verb::get);
+  m_endpoints.add_endpoint("/input/events",
+                           ROUTE_CALLBACK(input_events_request_handler),
+                           verb::get, verb::delete_);
+  m_endpoints.add_endpoint("/scene", ROUTE_CALLBACK(scene_request_handler),
+                           verb::get);
+  m_endpoints.add_endpoint("/screen/all",
+                           ROUTE_CALLBACK(all_screens_request_handler),
+                           verb::get);
   m_endpoints.add_special_endpoint("/screen/{screen_number}",
                                    ROUTE_CALLBACK(screenshot_request_handler),
                                    verb::get);
+  m_endpoints.add_special_endpoint(
+      "/screen/{screen_number}/stream",
+      ROUTE_CALLBACK(screen_stream_request_handler), verb::get);
+  m_endpoints.add_special_endpoint(
+      "/screen/{screen_number}/ws",
+      ROUTE_CALLBACK(screen_websocket_request_handler), verb::get);
+  m_endpoints.add_special_endpoint(
+      "/screen/{screen_number}/capture",
+      ROUTE_CALLBACK(capture_policy_request_handler), verb::get, verb::post);
+  m_endpoints.add_special_endpoint(
+      "/screen/{screen_number}/record/start",
+      ROUTE_CALLBACK(record_start_request_handler), verb::post);
+  m_endpoints.add_special_endpoint("/screen/{screen_number}/record/stop",
+                                   ROUTE_CALLBACK(record_stop_request_handler),
+                                   verb::post);
+  m_endpoints.add_special_endpoint(
+      "/recordings/{recording}/{frame_number}",
+      ROUTE_CALLBACK(recorded_frame_request_handler), verb::get);
+  m_endpoints.add_special_endpoint("/surface/{surface_id}",
+                                   ROUTE_CALLBACK(surface_request_handler),
+                                   verb::get);
+  m_endpoints.add_special_endpoint("/layer/{layer_id}",
+                                   ROUTE_CALLBACK(layer_request_handler),
+                                   verb::get);
+  m_endpoints.add_special_endpoint(
+      "/frames/{frame_id}", ROUTE_CALLBACK(archived_frame_request_handler),
+      verb::get);
   return shared_from_this();
 }
 
+namespace {
+struct backend_status_t {
+  std::atomic_bool screen = false;
+  std::atomic_bool input = false;
+};
+
+backend_status_t &backend_status() {
+  static backend_status_t status{};
+  return status;
+}
+} // namespace
+
+bool warm_up_backends(runtime_args_t const &args) {
+  auto const start = std::chrono::steady_clock::now();
+  auto &status = backend_status();
+  // uinput device creation overlaps with the KMS probing or the Wayland
+  // roundtrips of the screen backend
+  auto input = std::async(std::launch::async, [&args] {
+    try {
+      return get_input_object(args) != nullptr;
+    } catch (std::exception const &e) {
+      spdlog::error("unable to create input devices: {}", e.what());
+      return false;
+    }
+  });
+
+  if (auto screen = get_screen_object(args); screen) {
+    // one grab leaves a frame sized buffer in the pool for the first
+    // screenshot
+    raw_frame_t frame{};
+    try {
+      if (auto const ids = screen->screen_ids(); !ids.empty())
+        screen->grab_raw_frame(frame, ids.front());
+    } catch (std::exception const &e) {
+      spdlog::warn("screen warm up: {}", e.what());
+    }
+    buffer_pool_t::instance().release(std::move(frame.data));
+    status.screen = true;
+  } else {
+    spdlog::error("unable to create screen object");
+  }
+  status.input = input.get();
+
+  spdlog::info("Backends initialised in {}ms",
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count());
+  return status.screen && status.input;
+}
+
 base_screen_t *get_screen_object(runtime_args_t const &args) {
   base_screen_t *screen = nullptr;
   try {
     if (args.screen_backend == screen_type_e::ilm) {
       screen = ilm_screen_t::create_global_instance();
+    } else if (args.screen_backend == screen_type_e::synthetic) {
+      screen = synthetic_screen_t::create_global_instance(args.synthetic);
+    } else if (args.screen_backend == screen_type_e::screencopy) {
+      screen = screencopy_screen_t::create_global_instance();
     } else {
       screen = kms_screen_t::create_global_instance(args.kms_backend_cards,
                                                     args.kms_format_rgb);
@@ -244,15 +416,45 @@ base_screen_t *get_screen_object(runtime_args_t const &args) {
   return screen;
 }
 
+capture_service_t *get_capture_service(runtime_args_t const &args) {
+  auto screen = get_screen_object(args);
+  if (!screen)
+    return nullptr;
+  return capture_service_t::create_global_instance(
+      screen, {args.capture_policy, args.capture_fps}, args.capture_ring_size);
+}
+
+recording_service_t *get_recording_service(runtime_args_t const &args) {
+  auto screen = get_screen_object(args);
+  if (!screen)
+    return nullptr;
+  return recording_service_t::create_global_instance(screen,
+                                                     args.recording_dir);
+}
+
+frame_archive_t *get_frame_archive(runtime_args_t const &args) {
+  if (args.archive_dir.empty())
+    return nullptr;
+  return frame_archive_t::create_global_instance(args.archive_dir);
+}
+
 base_input_t *get_input_object(runtime_args_t const &args) {
   base_input_t *base = nullptr;
   if (args.input_backend == input_type_e::evdev)
     base = ev_dev_backend_t::create_global_instance();
+  else if (args.input_backend == input_type_e::record)
+    base = record_backend_t::create_global_instance(args.input_record);
   else
     base = uinput_backend_t::create_global_instance();
   return base;
 }
 
+record_backend_t *get_input_recorder(runtime_args_t const &args) {
+  if (args.input_backend != input_type_e::record)
+    return nullptr;
+  return record_backend_t::create_global_instance(args.input_record);
+}
+
 void session_t::move_mouse_request_handler(url_query_t const &) {
   auto &request = m_thisRequest;
   try {
@@ -317,16 +519,21 @@ void session_t::touch_request_handler(url_query_t const &) {
     auto const y = y_iter->second.get<json::number_integer_t>();
     auto const event = event_iter->second.get<json::number_integer_t>();
     auto const duration = duration_iter->second.get<json::number_integer_t>();
+    // checked before narrowing to int, the request is held until the touch
+    // is released
+    if (duration < 0 || duration > 60) {
+      return error_handler(
+          bad_request("duration must be within [0, 60]", request));
+    }
     spdlog::info("X: {}, Y: {}, event: {}, duration: {}", x, y, event,
                  duration);
     auto input_object = get_input_object(m_rt_arguments);
-    if (!input_object->touch(x, y, duration, event))
-      return error_handler(server_error("Error", request));
+    return play_gesture_request(input_object, event,
+                                touch_gesture(x, y, duration));
   } catch (std::exception const &e) {
     spdlog::error(e.what());
     return error_handler(bad_request(e.what(), request));
   }
-  send_response(json_success("OK", request));
 }
 
 void session_t::key_request_handler(url_query_t const &) {
@@ -372,14 +579,24 @@ void session_t::swipe_request_handler(url_query_t const &) {
     auto const event = event_iter->second.get<json::number_integer_t>();
     auto const velocity = velocity_iter->second.get<json::number_integer_t>();
 
+    // checked before narrowing to int, a step is sent every half a second
+    if (velocity < 1 || velocity > 1000) {
+      return error_handler(
+          bad_request("velocity must be within [1, 1000]", request));
+    }
+    for (auto const coordinate : {x, y, x2, y2}) {
+      if (coordinate < 0 || coordinate > 65535) {
+        return error_handler(bad_request(
+            "x, y, x2 and y2 must be within [0, 65535]", request));
+      }
+    }
     auto input_object = get_input_object(m_rt_arguments);
-    if (!input_object->swipe(x, y, x2, y2, velocity, event))
-      return error_handler(server_error("Error", request));
+    return play_gesture_request(input_object, event,
+                                swipe_gesture(x, y, x2, y2, velocity));
   } catch (std::exception const &e) {
     spdlog::error(e.what());
     return error_handler(bad_request(e.what(), request));
   }
-  send_response(json_success("OK", request));
 }
 
 void session_t::text_request_handler(url_query_t const &) {
@@ -394,6 +611,11 @@ void session_t::text_request_handler(url_query_t const &) {
     }
     auto const event = event_iter->second.get<json::number_integer_t>();
     auto const text_array = text_iter->second.get<json::array_t>();
+    // a key a second, the request is held until the last one is typed
+    if (text_array.size() > 300) {
+      return error_handler(
+          bad_request("text must be at most 300 keys long", request));
+    }
 
     std::vector<int> text_list;
     text_list.reserve(text_array.size());
@@ -401,13 +623,27 @@ void session_t::text_request_handler(url_query_t const &) {
       text_list.push_back(static_cast<int>(text.get<json::number_integer_t>()));
 
     auto input_object = get_input_object(m_rt_arguments);
-    if (!input_object->text(text_list, event))
-      return error_handler(server_error("Error", request));
+    return play_gesture_request(input_object, event, text_gesture(text_list));
   } catch (std::exception const &e) {
     spdlog::error(e.what());
     return error_handler(bad_request(e.what(), request));
   }
-  send_response(json_success("OK", request));
+}
+
+// timed gestures wait on timers rather than in the io threads, the reply
+// goes out once the last frame has been sent
+void session_t::play_gesture_request(base_input_t *input_object,
+                                     int const event, gesture_t &&gesture) {
+  play_gesture(
+      m_ioContext, input_object, event, std::move(gesture),
+      [self = shared_from_this()](bool const sent) {
+        net::post(self->m_tcpStream.get_executor(), [self, sent] {
+          auto &request = self->m_thisRequest;
+          if (!sent)
+            return self->error_handler(server_error("Error", request));
+          self->send_response(json_success("OK", request));
+        });
+      });
 }
 
 void session_t::screenshot_request_handler(url_query_t const &optional_query) {
@@ -428,12 +664,357 @@ void session_t::screenshot_request_handler(url_query_t const &optional_query) {
     return error_handler(bad_request("invalid screen id", request));
   }
 
-  image_data_t image{};
-  if (!screen_object->grab_frame_buffer(image, screen_id))
+  if (optional_query.count("count") != 0)
+    return burst_request(screen_object, screen_id, optional_query);
+
+  auto capture_service = get_capture_service(m_rt_arguments);
+  if (auto ring = capture_service ? capture_service->ring(screen_id) : nullptr;
+      ring) {
+    // served from the background capture: the newest frame, or the first
+    // one newer than `after`
+    uint64_t after = 0;
+    int timeout_ms = 1'000;
+    try {
+      if (auto const iter = optional_query.find("after");
+          iter != optional_query.cend())
+        after = std::stoull(iter->second);
+      if (auto const iter = optional_query.find("timeout_ms");
+          iter != optional_query.cend())
+        timeout_ms = std::stoi(iter->second);
+    } catch (std::exception const &) {
+      return error_handler(bad_request("invalid frame sequence", request));
+    }
+
+    if (auto const newest = ring->newest(); newest && after == 0)
+      return send_captured_frame(newest);
+
+    return ring->when_newer_than(
+        after, std::chrono::milliseconds(std::max(timeout_ms, 0)),
+        [self = shared_from_this()](captured_frame_ptr frame) {
+          net::post(self->m_tcpStream.get_executor(),
+                    [self, frame = std::move(frame)] {
+                      self->send_captured_frame(frame);
+                    });
+        });
+  }
+
+  // concurrent requests for the same screen share one capture and encode,
+  // which is skipped altogether when the client already has the frame
+  auto flights = screenshot_flights_t::create_global_instance(
+      screen_object, get_frame_archive(m_rt_arguments));
+  flights->request(
+      screen_id, parse_entity_tags(request[http::field::if_none_match]),
+      [self = shared_from_this()](screenshot_result_t result) {
+        net::post(self->m_tcpStream.get_executor(), [self,
+                                                     result = std::move(
+                                                         result)]() mutable {
+          auto &request = self->m_thisRequest;
+          if (!result.captured) {
+            return self->error_handler(
+                server_error("unable to get screenshot", request));
+          }
+          if (result.not_modified) {
+            auto response = not_modified(result.hash, request);
+            if (!result.frame_id.empty())
+              response.set("X-Frame-Id", result.frame_id);
+            return self->send_response(std::move(response));
+          }
+          if (!result.image) {
+            return self->error_handler(
+                server_error("unable to encode screenshot", request));
+          }
+          auto response = image_response(*result.image, request);
+          response.set(http::field::etag, entity_tag(result.hash));
+          if (!result.frame_id.empty())
+            response.set("X-Frame-Id", result.frame_id);
+          self->send_image(std::move(response), std::move(result.image));
+        });
+      });
+}
+
+void session_t::burst_request(base_screen_t *screen_object,
+                              int const screen_id,
+                              url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  int count = 0;
+  int interval_ms = 100;
+  try {
+    count = std::stoi(optional_query.at("count"));
+    if (auto const iter = optional_query.find("interval_ms");
+        iter != optional_query.cend())
+      interval_ms = std::stoi(iter->second);
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid burst parameters", request));
+  }
+
+  if (count < 1 || count > 100)
+    return error_handler(bad_request("count must be within [1, 100]", request));
+  if (interval_ms < 0 || interval_ms > 10'000) {
+    return error_handler(
+        bad_request("interval_ms must be within [0, 10000]", request));
+  }
+
+  bool const started = capture_burst(
+      screen_object, screen_id, count, std::chrono::milliseconds(interval_ms),
+      [self = shared_from_this()](std::vector<burst_frame_t> frames) {
+        net::post(self->m_tcpStream.get_executor(),
+                  [self, frames = std::move(frames)] {
+                    self->send_burst(frames);
+                  });
+      });
+  if (!started) {
+    return error_handler(get_error("too many bursts in progress",
+                                   http::status::service_unavailable,
+                                   request));
+  }
+}
+
+void session_t::send_burst(std::vector<burst_frame_t> const &frames) {
+  auto &request = m_thisRequest;
+  if (frames.empty())
+    return error_handler(server_error("unable to get screenshot", request));
+
+  // one part per frame, in capture order
+  constexpr char const *boundary = "qadxburst";
+  std::size_t body_size = 0;
+  for (auto const &frame : frames)
+    body_size += frame.image->buffer.size() + 256;
+
+  std::string body{};
+  body.reserve(body_size);
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    auto const &frame = frames[i];
+    auto const timestamp =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            frame.timestamp.time_since_epoch());
+    body += fmt::format("--{}\r\n"
+                        "Content-Type: {}\r\n"
+                        "Content-Length: {}\r\n"
+                        "ETag: {}\r\n"
+                        "X-Frame-Sequence: {}\r\n"
+                        "X-Frame-Timestamp: {}\r\n"
+                        "X-Frame-Offset: {}\r\n\r\n",
+                        boundary, image_content_type(frame.image->type),
+                        frame.image->buffer.size(), entity_tag(frame.hash), i,
+                        timestamp.count(), frame.offset.count());
+    body.append(reinterpret_cast<char const *>(frame.image->buffer.data()),
+                frame.image->buffer.size());
+    body += "\r\n";
+  }
+  body += fmt::format("--{}--\r\n", boundary);
+  send_response(multipart_response(std::move(body), boundary, request));
+}
+
+void session_t::all_screens_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto screen_object = get_screen_object(m_rt_arguments);
+  if (!screen_object) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  bool manifest = false;
+  if (auto const iter = optional_query.find("format");
+      iter != optional_query.cend()) {
+    if (iter->second != "json" && iter->second != "multipart") {
+      return error_handler(
+          bad_request("format must be multipart or json", request));
+    }
+    manifest = iter->second == "json";
+  }
+
+  std::vector<int> screen_ids{};
+  if (auto const iter = optional_query.find("screens");
+      iter != optional_query.cend()) {
+    try {
+      for (auto const &id : utils::split_string_view(iter->second, ",")) {
+        std::size_t parsed = 0;
+        screen_ids.push_back(std::stoi(id, &parsed));
+        if (parsed != id.size())
+          throw std::invalid_argument(id);
+      }
+    } catch (std::exception const &) {
+      return error_handler(bad_request("invalid screen id", request));
+    }
+  } else {
+    screen_ids = screen_object->screen_ids();
+  }
+  if (screen_ids.empty()) {
+    return error_handler(
+        get_error("no screen to capture", http::status::not_found, request));
+  }
+
+  // the manifest refers to the frames by their frame id, which only the
+  // archive can serve
+  auto archive = get_frame_archive(m_rt_arguments);
+  if (manifest && !archive) {
+    return error_handler(bad_request(
+        "a manifest needs the frame archive, see --archive-dir", request));
+  }
+
+  capture_screens(
+      screen_object, std::move(screen_ids), !manifest,
+      [self = shared_from_this(), archive,
+       manifest](std::vector<screen_frame_t> frames) {
+        std::vector<std::string> frame_ids(frames.size());
+        if (manifest) {
+          for (std::size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i].captured)
+              frame_ids[i] = archive->store(frames[i].hash, frames[i].frame);
+          }
+        }
+        net::post(self->m_tcpStream.get_executor(),
+                  [self, manifest, frames = std::move(frames),
+                   frame_ids = std::move(frame_ids)] {
+                    if (manifest)
+                      return self->send_screens_manifest(frames, frame_ids);
+                    self->send_screens(frames);
+                  });
+      });
+}
+
+void session_t::send_screens(std::vector<screen_frame_t> const &frames) {
+  auto &request = m_thisRequest;
+  // one part per screen captured, in the order asked for
+  constexpr char const *boundary = "qadxscreens";
+  std::size_t body_size = 0;
+  for (auto const &frame : frames)
+    body_size += frame.image.buffer.size() + 256;
+
+  std::string body{};
+  body.reserve(body_size);
+  for (auto const &frame : frames) {
+    if (!frame.captured)
+      continue;
+    auto const timestamp =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            frame.timestamp.time_since_epoch());
+    body += fmt::format("--{}\r\n"
+                        "Content-Type: {}\r\n"
+                        "Content-Length: {}\r\n"
+                        "ETag: {}\r\n"
+                        "X-Screen-Id: {}\r\n"
+                        "X-Frame-Timestamp: {}\r\n"
+                        "X-Frame-Offset: {}\r\n\r\n",
+                        boundary, image_content_type(frame.image.type),
+                        frame.image.buffer.size(), entity_tag(frame.hash),
+                        frame.screen_id, timestamp.count(),
+                        frame.offset.count());
+    body.append(reinterpret_cast<char const *>(frame.image.buffer.data()),
+                frame.image.buffer.size());
+    body += "\r\n";
+  }
+  if (body.empty())
     return error_handler(server_error("unable to get screenshot", request));
+  body += fmt::format("--{}--\r\n", boundary);
+  send_response(multipart_response(std::move(body), boundary, request));
+}
 
-  auto const filename = save_image_to_file(image);
-  send_file(filename, request);
+void session_t::send_screens_manifest(
+    std::vector<screen_frame_t> const &frames,
+    std::vector<std::string> const &frame_ids) {
+  json::array_t screens{};
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    auto const &frame = frames[i];
+    json::object_t entry{};
+    entry["screen"] = frame.screen_id;
+    entry["captured"] = frame.captured && !frame_ids[i].empty();
+    if (frame.captured && !frame_ids[i].empty()) {
+      entry["frame_id"] = frame_ids[i];
+      entry["timestamp"] =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              frame.timestamp.time_since_epoch())
+              .count();
+      entry["offset"] = frame.offset.count();
+    }
+    screens.push_back(std::move(entry));
+  }
+  json::object_t result{};
+  result["screens"] = std::move(screens);
+  send_response(json_success(result, m_thisRequest));
+}
+
+void session_t::screen_stream_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto screen_object = get_screen_object(m_rt_arguments);
+  if (!screen_object) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  int screen_id = 0;
+  int fps = 5;
+  int quality = 75;
+  try {
+    screen_id = std::stoi(optional_query.at("screen_number"));
+    if (auto const iter = optional_query.find("fps");
+        iter != optional_query.cend())
+      fps = std::stoi(iter->second);
+    if (auto const iter = optional_query.find("quality");
+        iter != optional_query.cend())
+      quality = std::stoi(iter->second);
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid stream parameters", request));
+  }
+
+  if (fps < 1 || fps > 60)
+    return error_handler(bad_request("fps must be within [1, 60]", request));
+  if (quality < 1 || quality > 100) {
+    return error_handler(
+        bad_request("quality must be within [1, 100]", request));
+  }
+
+  // the stream owns the connection from here on, this session is done
+  std::make_shared<mjpeg_session_t>(std::move(m_tcpStream), screen_object,
+                                    screen_id, fps, quality)
+      ->run(request);
+}
+
+void session_t::screen_websocket_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  if (!websocket::is_upgrade(request))
+    return error_handler(bad_request("expected a websocket upgrade", request));
+
+  auto screen_object = get_screen_object(m_rt_arguments);
+  if (!screen_object) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  int screen_id = 0;
+  websocket_stream_options_t options{};
+  try {
+    screen_id = std::stoi(optional_query.at("screen_number"));
+    if (auto const iter = optional_query.find("fps");
+        iter != optional_query.cend())
+      options.fps = std::stoi(iter->second);
+    if (auto const iter = optional_query.find("window");
+        iter != optional_query.cend())
+      options.window = std::stoi(iter->second);
+    if (auto const iter = optional_query.find("keyframe_interval");
+        iter != optional_query.cend())
+      options.keyframe_interval = std::stoi(iter->second);
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid stream parameters", request));
+  }
+
+  if (options.fps < 1 || options.fps > 60)
+    return error_handler(bad_request("fps must be within [1, 60]", request));
+  if (options.window < 1 || options.window > 64) {
+    return error_handler(
+        bad_request("window must be within [1, 64]", request));
+  }
+  if (options.keyframe_interval < 0) {
+    return error_handler(
+        bad_request("keyframe_interval cannot be negative", request));
+  }
+
+  std::make_shared<websocket_session_t>(std::move(m_tcpStream), screen_object,
+                                        screen_id, options)
+      ->run(request);
 }
 
 void session_t::screen_request_handler(url_query_t const &optional_query) {
@@ -447,42 +1028,483 @@ void session_t::screen_request_handler(url_query_t const &optional_query) {
   return send_response(json_success(screen_object->list_screens(), request));
 }
 
-void session_t::send_file(std::filesystem::path const &file_path,
-                          string_request_t const &request) {
-  std::error_code ec_{};
-  if (!std::filesystem::exists(file_path, ec_))
-    return error_handler(bad_request("file does not exist", request));
+void session_t::ready_request_handler(url_query_t const &) {
+  auto &request = m_thisRequest;
+  auto const &status = backend_status();
+  json::object_t result{};
+  result["screen"] = status.screen.load();
+  result["input"] = status.input.load();
+  result["ready"] = status.screen && status.input;
+  auto response = json_success(result, request);
+  if (!(status.screen && status.input)) {
+    response.result(http::status::service_unavailable);
+    response.prepare_payload();
+  }
+  send_response(std::move(response));
+}
 
-  http::file_body::value_type file;
-  beast::error_code ec{};
-  file.open(file_path.string().c_str(), beast::file_mode::read, ec);
-  if (ec) {
+void session_t::capture_policy_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto capture_service = get_capture_service(m_rt_arguments);
+  if (!capture_service) {
     return error_handler(
-        server_error("unable to open file specified", request));
+        server_error("unable to create screen object", request));
   }
 
-  using http::field;
+  int screen_id = 0;
+  try {
+    screen_id = std::stoi(optional_query.at("screen_number"));
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid screen id", request));
+  }
 
-  auto &response =
-      m_fileResponse.emplace(std::piecewise_construct, std::make_tuple(),
-                             std::make_tuple(m_fileAlloc));
-  response.result(http::status::ok);
-  response.keep_alive(request.keep_alive());
+  auto const current = capture_service->policy(screen_id);
+  if (!current)
+    return error_handler(bad_request("invalid screen id", request));
+  auto policy = *current;
+  if (request.method() == http::verb::post) {
+    try {
+      if (auto const iter = optional_query.find("policy");
+          iter != optional_query.cend()) {
+        auto const name = to_capture_policy(iter->second);
+        if (!name)
+          return error_handler(bad_request("invalid capture policy", request));
+        policy.policy = *name;
+      }
+      if (auto const iter = optional_query.find("fps");
+          iter != optional_query.cend())
+        policy.fps = std::stoi(iter->second);
+    } catch (std::exception const &) {
+      return error_handler(bad_request("invalid capture parameters", request));
+    }
+    if (policy.fps < 1 || policy.fps > 60)
+      return error_handler(bad_request("fps must be within [1, 60]", request));
+    if (!capture_service->set_policy(screen_id, policy))
+      return error_handler(bad_request("invalid screen id", request));
+  }
+
+  json::object_t result{};
+  result["policy"] = to_string(policy.policy);
+  result["fps"] = policy.fps;
+  send_response(json_success(result, request));
+}
+
+void session_t::record_start_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto recording_service = get_recording_service(m_rt_arguments);
+  if (!recording_service) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  int screen_id = 0;
+  recording_options_t options{};
+  try {
+    screen_id = std::stoi(optional_query.at("screen_number"));
+    if (auto const iter = optional_query.find("fps");
+        iter != optional_query.cend())
+      options.fps = std::stoi(iter->second);
+    if (auto const iter = optional_query.find("keyframe_interval");
+        iter != optional_query.cend())
+      options.keyframe_interval = std::stoi(iter->second);
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid recording parameters", request));
+  }
+
+  if (options.fps < 1 || options.fps > 60)
+    return error_handler(bad_request("fps must be within [1, 60]", request));
+  if (options.keyframe_interval < 1) {
+    return error_handler(
+        bad_request("keyframe_interval must be at least 1", request));
+  }
+
+  std::optional<recording_info_t> info{};
+  try {
+    info = recording_service->start(screen_id, options);
+  } catch (std::exception const &e) {
+    spdlog::error(e.what());
+    return error_handler(server_error("unable to start recording", request));
+  }
+  if (!info) {
+    return error_handler(get_error("the screen is already being recorded",
+                                   http::status::conflict, request));
+  }
+
+  json::object_t result{};
+  result["file"] = info->path;
+  send_response(json_success(result, request));
+}
+
+void session_t::record_stop_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto recording_service = get_recording_service(m_rt_arguments);
+  if (!recording_service) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  int screen_id = 0;
+  try {
+    screen_id = std::stoi(optional_query.at("screen_number"));
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid screen id", request));
+  }
+
+  auto const info = recording_service->stop(screen_id);
+  if (!info) {
+    return error_handler(get_error("the screen is not being recorded",
+                                   http::status::not_found, request));
+  }
+
+  json::object_t result{};
+  result["file"] = info->path;
+  result["frames"] = info->frames;
+  result["bytes"] = info->bytes;
+  send_response(json_success(result, request));
+}
+
+void session_t::recorded_frame_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto recording_service = get_recording_service(m_rt_arguments);
+  if (!recording_service) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  auto const &name = optional_query.at("recording");
+  std::size_t frame_number = 0;
+  try {
+    frame_number = std::stoull(optional_query.at("frame_number"));
+  } catch (std::exception const &) {
+    return error_handler(bad_request("invalid frame number", request));
+  }
+  // only the recordings this server wrote, nothing outside their directory
+  if (name.empty() || name.front() == '.' ||
+      !boost::ends_with(name, ".qadrec"))
+    return error_handler(not_found(request));
+
+  raw_frame_t frame{};
+  uint64_t timestamp_us = 0;
+  try {
+    recording_reader_t reader{recording_service->directory() / name};
+    if (frame_number >= reader.frame_count() ||
+        !reader.read_frame(frame_number, frame))
+      return error_handler(not_found(request));
+    timestamp_us = reader.entry(frame_number).timestamp_us;
+  } catch (std::exception const &e) {
+    spdlog::error(e.what());
+    return error_handler(not_found(request));
+  }
+
+  auto image = make_pooled_image();
+  try {
+    write_png(frame.data.data(), frame.width, frame.height, frame.stride,
+              frame.bpp, frame.rgb, *image);
+  } catch (std::exception const &e) {
+    spdlog::error(e.what());
+    return error_handler(server_error("unable to encode frame", request));
+  }
+  auto response = image_response(*image, request);
+  response.set("X-Frame-Timestamp", std::to_string(timestamp_us));
+  send_image(std::move(response), std::move(image));
+}
+
+void session_t::archived_frame_request_handler(
+    url_query_t const &optional_query) {
+  auto &request = m_thisRequest;
+  auto archive = get_frame_archive(m_rt_arguments);
+  if (!archive)
+    return error_handler(not_found(request));
+
+  auto const &frame_id = optional_query.at("frame_id");
+  auto const path = archive->find(frame_id);
+  if (!path)
+    return error_handler(not_found(request));
+
+  // archived frames never change, the id is a strong validator
+  auto const etag = "\"" + frame_id + "\"";
+  if (request[http::field::if_none_match].find(etag) !=
+      boost::string_view::npos) {
+    using http::field;
+    string_response_t response{http::status::not_modified, request.version()};
+    response.set(field::server, "qadx-server");
+    response.set(field::etag, etag);
+    response.set(field::cache_control, "public, max-age=31536000, immutable");
+    response.set(field::access_control_allow_origin, "*");
+    response.set(field::access_control_allow_methods, "GET, POST");
+    response.set(field::access_control_allow_headers,
+                 "Content-Type, Authorization");
+    response.keep_alive(request.keep_alive());
+    return send_response(std::move(response));
+  }
+
+  std::ifstream in_file(*path, std::ios::in | std::ios::binary);
+  std::error_code ec{};
+  auto const file_size = std::filesystem::file_size(*path, ec);
+  if (!in_file || ec)
+    return error_handler(server_error("unable to read frame", request));
+
+  string_response_t response{http::status::ok, request.version()};
+  uint64_t first = 0;
+  uint64_t last = file_size == 0 ? 0 : file_size - 1;
+  if (auto const range = request[http::field::range]; !range.empty()) {
+    using kind_e = byte_range_t::kind_e;
+    auto const byte_range = parse_byte_range(range, file_size);
+    if (byte_range.kind == kind_e::unsatisfiable) {
+      response = get_error("range not satisfiable",
+                           http::status::range_not_satisfiable, request);
+      response.set(http::field::content_range,
+                   fmt::format("bytes */{}", file_size));
+      return error_handler(std::move(response));
+    }
+    if (byte_range.kind == kind_e::partial) {
+      first = byte_range.first;
+      last = byte_range.last;
+      response.result(http::status::partial_content);
+      response.set(http::field::content_range,
+                   fmt::format("bytes {}-{}/{}", first, last, file_size));
+    }
+  }
+
+  auto &body = response.body();
+  body.resize(file_size == 0 ? 0 : last - first + 1);
+  in_file.seekg(static_cast<std::streamoff>(first));
+  if (!in_file.read(body.data(), static_cast<std::streamsize>(body.size())))
+    return error_handler(server_error("unable to read frame", request));
+
+  using http::field;
+  response.set(field::content_type, "image/png");
   response.set(field::server, "qadx-server");
+  response.set(field::etag, etag);
+  response.set(field::accept_ranges, "bytes");
+  response.set(field::cache_control, "public, max-age=31536000, immutable");
   response.set(field::access_control_allow_origin, "*");
   response.set(field::access_control_allow_methods, "GET, POST");
   response.set(field::access_control_allow_headers,
                "Content-Type, Authorization");
-  response.body() = std::move(file);
+  response.keep_alive(request.keep_alive());
+  response.prepare_payload();
+  send_response(std::move(response));
+}
+
+void session_t::input_events_request_handler(url_query_t const &) {
+  auto &request = m_thisRequest;
+  auto recorder = get_input_recorder(m_rt_arguments);
+  if (!recorder)
+    return error_handler(not_found(request));
+  if (!recorder->records_to_ring()) {
+    return error_handler(bad_request(
+        "input events are recorded to " + m_rt_arguments.input_record,
+        request));
+  }
+  if (request.method() == http::verb::delete_) {
+    recorder->clear();
+    return send_response(json_success("OK", request));
+  }
+
+  // the records as they're laid out in memory, for byte-wise comparison
+  uint64_t dropped = 0;
+  auto const records = recorder->recorded_events(dropped);
+  using http::field;
+  string_response_t response{http::status::ok, request.version()};
+  response.set(field::content_type, "application/octet-stream");
+  response.set(field::server, "qadx-server");
+  response.set(field::cache_control, "no-cache");
+  response.set("X-Dropped-Events", std::to_string(dropped));
+  response.set(field::access_control_allow_origin, "*");
+  response.set(field::access_control_allow_methods, "GET, DELETE");
+  response.set(field::access_control_allow_headers,
+               "Content-Type, Authorization");
+  response.keep_alive(request.keep_alive());
+  response.body().assign(reinterpret_cast<char const *>(records.data()),
+                         records.size() * sizeof(input_record_t));
   response.prepare_payload();
+  send_response(std::move(response));
+}
+
+void session_t::scene_request_handler(url_query_t const &) {
+  auto &request = m_thisRequest;
+  if (m_rt_arguments.screen_backend != screen_type_e::ilm)
+    return error_handler(not_found(request));
+  auto screen = ilm_screen_t::create_global_instance();
+  if (!screen) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  auto const scene = screen->scene();
+  auto const rectangle = [](ivi_rectangle_t const &area) {
+    return json::object_t{{"x", area.x},
+                          {"y", area.y},
+                          {"width", area.width},
+                          {"height", area.height}};
+  };
+  json::array_t screens{};
+  for (auto const &[screen_id, layers] : scene.screen_layers)
+    screens.push_back(json::object_t{{"id", screen_id}, {"layers", layers}});
+  json::array_t layers{};
+  for (auto const &[layer_id, layer] : scene.layers) {
+    layers.push_back(
+        json::object_t{{"id", layer_id},
+                       {"visible", layer.visible},
+                       {"destination", rectangle(layer.destination)},
+                       {"surfaces", layer.surfaces}});
+  }
+  json::array_t surfaces{};
+  for (auto const &[surface_id, surface] : scene.surfaces) {
+    surfaces.push_back(
+        json::object_t{{"id", surface_id},
+                       {"visible", surface.visible},
+                       {"width", surface.width},
+                       {"height", surface.height},
+                       {"destination", rectangle(surface.destination)}});
+  }
+  json::object_t result{};
+  result["screens"] = std::move(screens);
+  result["layers"] = std::move(layers);
+  result["surfaces"] = std::move(surfaces);
+  send_response(json_success(result, request));
+}
+
+void session_t::surface_request_handler(url_query_t const &optional_query) {
+  ivi_capture_request(optional_query, true);
+}
+
+void session_t::layer_request_handler(url_query_t const &optional_query) {
+  ivi_capture_request(optional_query, false);
+}
 
-  m_fileSerializer.emplace(*m_fileResponse);
-  http::async_write(m_tcpStream, *m_fileSerializer,
-                    [file_path, self = shared_from_this()](
-                        beast::error_code const ec, size_t const size_written) {
-                      self->m_fileSerializer.reset();
-                      self->m_fileResponse.reset();
-                      std::filesystem::remove(file_path);
+// a single ivi surface or layer, encoded like a screenshot of the screen
+void session_t::ivi_capture_request(url_query_t const &optional_query,
+                                    bool const surface) {
+  auto &request = m_thisRequest;
+  if (m_rt_arguments.screen_backend != screen_type_e::ilm)
+    return error_handler(not_found(request));
+  auto screen = ilm_screen_t::create_global_instance();
+  if (!screen) {
+    return error_handler(
+        server_error("unable to create screen object", request));
+  }
+
+  uint32_t id = 0;
+  try {
+    auto const &value = optional_query.at(surface ? "surface_id" : "layer_id");
+    std::size_t pos = 0;
+    auto const parsed = std::stoul(value, &pos);
+    if (pos != value.size() || parsed > UINT32_MAX)
+      throw std::invalid_argument(value);
+    id = static_cast<uint32_t>(parsed);
+  } catch (std::exception const &) {
+    return error_handler(bad_request(
+        surface ? "invalid surface id" : "invalid layer id", request));
+  }
+
+  // encoded on the backend's completion thread, sent from the session's
+  auto on_frames = [self = shared_from_this(),
+                    screen](std::vector<raw_frame_t> frames) {
+    std::shared_ptr<image_data_t const> image = nullptr;
+    auto &frame = frames[0];
+    if (!frame.data.empty()) {
+      try {
+        auto encoded = make_pooled_image();
+        screen->encode_raw_frame(frame, *encoded);
+        image = std::move(encoded);
+      } catch (std::exception const &e) {
+        spdlog::error("encoding ivi capture: {}", e.what());
+      }
+    }
+    buffer_pool_t::instance().release(std::move(frame.data));
+    net::post(self->m_tcpStream.get_executor(), [self, image]() mutable {
+      auto &request = self->m_thisRequest;
+      if (!image) {
+        return self->error_handler(
+            server_error("unable to get screenshot", request));
+      }
+      auto response = image_response(*image, request);
+      self->send_image(std::move(response), std::move(image));
+    });
+  };
+  if (surface)
+    screen->grab_surface_async(id, std::move(on_frames));
+  else
+    screen->grab_layer_async(id, std::move(on_frames));
+}
+
+void session_t::send_captured_frame(captured_frame_ptr const &frame) {
+  auto &request = m_thisRequest;
+  if (!frame) {
+    return error_handler(get_error("no frame was captured in time",
+                                   http::status::service_unavailable,
+                                   request));
+  }
+
+  auto archive = get_frame_archive(m_rt_arguments);
+  // whether the client has this frame already
+  bool const has_frame =
+      parse_entity_tags(request[http::field::if_none_match])
+          .matches(frame->hash);
+  if (has_frame && !archive)
+    return send_encoded_frame(frame, true, nullptr, {});
+  if (has_frame && archive->contains(frame->hash)) {
+    return send_encoded_frame(frame, true, nullptr,
+                              frame_archive_t::frame_id(frame->hash));
+  }
+
+  // encoded once for every request of this frame, off the io threads
+  encode_captured_frame(
+      frame, archive,
+      [self = shared_from_this(), frame,
+       has_frame](std::shared_ptr<image_data_t const> image,
+                  std::string const &frame_id) {
+        net::post(self->m_tcpStream.get_executor(),
+                  [self, frame, has_frame, image = std::move(image),
+                   frame_id] {
+                    self->send_encoded_frame(frame, has_frame, image,
+                                             frame_id);
+                  });
+      });
+}
+
+void session_t::send_encoded_frame(captured_frame_ptr const &frame,
+                                   bool const has_frame,
+                                   std::shared_ptr<image_data_t const> image,
+                                   std::string const &frame_id) {
+  auto &request = m_thisRequest;
+  if (has_frame) {
+    auto response = not_modified(frame->hash, request);
+    response.set("X-Frame-Sequence", std::to_string(frame->sequence));
+    if (!frame_id.empty())
+      response.set("X-Frame-Id", frame_id);
+    return send_response(std::move(response));
+  }
+  if (!image)
+    return error_handler(server_error("unable to encode frame", request));
+
+  auto response = image_response(*image, request);
+  if (!frame_id.empty())
+    response.set("X-Frame-Id", frame_id);
+  auto const timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+      frame->timestamp.time_since_epoch());
+  response.set(http::field::etag, entity_tag(frame->hash));
+  response.set("X-Frame-Sequence", std::to_string(frame->sequence));
+  response.set("X-Frame-Timestamp", std::to_string(timestamp.count()));
+  send_image(std::move(response), std::move(image));
+}
+
+void session_t::send_image(image_response_t &&response,
+                           std::shared_ptr<image_data_t const> image) {
+  // the response body points into `image`, keep it until it's written
+  m_cachedImage = std::move(image);
+  auto &image_response = m_imageResponse.emplace(std::move(response));
+  http::async_write(m_tcpStream, image_response,
+                    [self = shared_from_this()](beast::error_code const ec,
+                                                size_t const size_written) {
+                      self->m_imageResponse.reset();
+                      self->m_cachedImage = nullptr;
                       self->on_data_written(ec, size_written);
                     });
 }
@@ -507,6 +1529,26 @@ string_response_t session_t::method_not_allowed(string_request_t const &req) {
   return get_error("method not allowed", http::status::method_not_allowed, req);
 }
 
+image_response_t session_t::image_response(image_data_t const &image,
+                                           string_request_t const &request) {
+  using http::field;
+
+  image_response_t response{http::status::ok, request.version()};
+  response.set(field::content_type, image_content_type(image.type));
+  response.set(field::server, "qadx-server");
+  response.set(field::cache_control, "no-cache");
+  response.set(field::access_control_allow_origin, "*");
+  response.set(field::access_control_allow_methods, "GET, POST");
+  response.set(field::access_control_allow_headers,
+               "Content-Type, Authorization");
+  response.keep_alive(request.keep_alive());
+  response.body().data = const_cast<unsigned char *>(image.buffer.data());
+  response.body().size = image.buffer.size();
+  response.body().more = false;
+  response.prepare_payload();
+  return response;
+}
+
 string_response_t
 session_t::allowed_options(std::vector<http::verb> const &verbs,
                            string_request_t const &request) {
@@ -554,6 +1596,40 @@ string_response_t session_t::get_error(std::string const &error_message,
   return response;
 }
 
+string_response_t session_t::not_modified(uint64_t const hash,
+                                          string_request_t const &req) {
+  using http::field;
+  string_response_t response{http::status::not_modified, req.version()};
+  response.set(field::server, "qadx-server");
+  response.set(field::etag, entity_tag(hash));
+  response.set(field::cache_control, "no-cache");
+  response.set(field::access_control_allow_origin, "*");
+  response.set(field::access_control_allow_methods, "GET, POST");
+  response.set(field::access_control_allow_headers,
+               "Content-Type, Authorization");
+  response.keep_alive(req.keep_alive());
+  return response;
+}
+
+string_response_t session_t::multipart_response(std::string &&body,
+                                                char const *boundary,
+                                                string_request_t const &req) {
+  using http::field;
+  string_response_t response{http::status::ok, req.version()};
+  response.set(field::content_type,
+               fmt::format("multipart/mixed; boundary={}", boundary));
+  response.set(field::server, "qadx-server");
+  response.set(field::cache_control, "no-cache");
+  response.set(field::access_control_allow_origin, "*");
+  response.set(field::access_control_allow_methods, "GET, POST");
+  response.set(field::access_control_allow_headers,
+               "Content-Type, Authorization");
+  response.keep_alive(req.keep_alive());
+  response.body() = std::move(body);
+  response.prepare_payload();
+  return response;
+}
+
 string_response_t session_t::json_success(json const &body,
                                           string_request_t const &req) {
   using http::field;
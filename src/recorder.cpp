@@ -0,0 +1,367 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "recorder.hpp"
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <zstd.h>
+
+namespace qadx {
+namespace details {
+constexpr char recording_magic[8] = {'Q', 'A', 'D', 'X', 'R', 'E', 'C', '1'};
+constexpr char index_magic[8] = {'Q', 'A', 'D', 'X', 'I', 'D', 'X', '1'};
+constexpr uint16_t recording_version = 1;
+
+#pragma pack(push, 1)
+struct recording_file_header_t {
+  char magic[8]{};
+  uint16_t version{};
+  uint16_t tile_size{};
+  uint32_t reserved{};
+};
+
+struct recording_footer_t {
+  uint64_t index_offset{};
+  uint32_t frame_count{};
+  uint32_t reserved{};
+  char magic[8]{};
+};
+
+struct recording_rect_t {
+  uint16_t x{};
+  uint16_t y{};
+  uint16_t width{};
+  uint16_t height{};
+};
+#pragma pack(pop)
+
+struct zstd_cctx_deleter_t {
+  void operator()(ZSTD_CCtx *ctx) const { ZSTD_freeCCtx(ctx); }
+};
+
+template <typename T> void append(std::vector<unsigned char> &out, T const &v) {
+  auto const *p = reinterpret_cast<unsigned char const *>(&v);
+  out.insert(out.end(), p, p + sizeof v);
+}
+
+bool same_geometry(raw_frame_t const &a, raw_frame_t const &b) {
+  return a.width == b.width && a.height == b.height && a.stride == b.stride &&
+         a.bpp == b.bpp && a.rgb == b.rgb && a.data.size() == b.data.size();
+}
+
+uint64_t now_in_microseconds() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace details
+
+screen_recorder_t::screen_recorder_t(base_screen_t *screen,
+                                     int const screen_id, std::string path,
+                                     recording_options_t const &options)
+    : m_screen(screen), m_screenId(screen_id), m_options(options),
+      m_path(std::move(path)),
+      m_file(m_path, std::ios::out | std::ios::binary | std::ios::trunc) {
+  if (!m_file)
+    throw std::runtime_error("unable to create " + m_path);
+
+  details::recording_file_header_t header{};
+  memcpy(header.magic, details::recording_magic, sizeof header.magic);
+  header.version = details::recording_version;
+  header.tile_size = static_cast<uint16_t>(m_options.tile_size);
+  m_file.write(reinterpret_cast<char const *>(&header), sizeof header);
+  m_bytes = sizeof header;
+  m_thread = std::thread([this] { record_loop(); });
+}
+
+screen_recorder_t::~screen_recorder_t() { stop(); }
+
+void screen_recorder_t::stop() {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stopped = true;
+  }
+  m_stopCondition.notify_all();
+  if (!m_thread.joinable())
+    return;
+  m_thread.join();
+  finish();
+}
+
+recording_info_t screen_recorder_t::info() const {
+  return {m_path, m_frames.load(), m_bytes.load()};
+}
+
+void screen_recorder_t::record_loop() {
+  using namespace details;
+  spdlog::info("Recording screen {} to {}", m_screenId, m_path);
+
+  std::unique_ptr<ZSTD_CCtx, zstd_cctx_deleter_t> const context{
+      ZSTD_createCCtx()};
+  auto const interval =
+      std::chrono::microseconds(1'000'000 / std::max(m_options.fps, 1));
+  raw_frame_t previous{};
+  raw_frame_t current{};
+  std::vector<unsigned char> payload{};
+  std::vector<unsigned char> compressed{};
+  int since_keyframe = 0;
+  uint32_t sequence = 0;
+
+  auto next_capture = std::chrono::steady_clock::now();
+  while (!m_stopped) {
+    try {
+      if (context && m_screen->grab_raw_frame(current, m_screenId)) {
+        auto const timestamp = now_in_microseconds();
+        bool const keyframe = since_keyframe == 0 ||
+                              since_keyframe >= m_options.keyframe_interval ||
+                              !same_geometry(previous, current);
+        auto const rects =
+            keyframe ? std::vector<frame_rect_t>{{0, 0, current.width,
+                                                  current.height}}
+                     : find_dirty_tiles(previous, current,
+                                        m_options.tile_size);
+
+        auto const bytes_per_pixel = current.bpp / 8;
+        payload.clear();
+        for (auto const &rect : rects) {
+          append(payload, recording_rect_t{
+                              static_cast<uint16_t>(rect.x),
+                              static_cast<uint16_t>(rect.y),
+                              static_cast<uint16_t>(rect.width),
+                              static_cast<uint16_t>(rect.height)});
+          auto const row_length = (size_t)rect.width * bytes_per_pixel;
+          for (int row = rect.y; row < rect.y + rect.height; ++row) {
+            auto const *in = current.data.data() +
+                             (size_t)row * current.stride +
+                             (size_t)rect.x * bytes_per_pixel;
+            payload.insert(payload.end(), in, in + row_length);
+          }
+        }
+
+        size_t compressed_size = 0;
+        if (!payload.empty()) {
+          compressed.resize(ZSTD_compressBound(payload.size()));
+          compressed_size = ZSTD_compressCCtx(
+              context.get(), compressed.data(), compressed.size(),
+              payload.data(), payload.size(), m_options.compression_level);
+          if (ZSTD_isError(compressed_size))
+            throw std::runtime_error(ZSTD_getErrorName(compressed_size));
+        }
+
+        recording_frame_header_t header{};
+        header.type = keyframe ? 0 : 1;
+        header.rgb = static_cast<uint8_t>(current.rgb);
+        header.bpp = static_cast<uint8_t>(current.bpp);
+        header.sequence = ++sequence;
+        header.timestamp_us = timestamp;
+        header.width = static_cast<uint16_t>(current.width);
+        header.height = static_cast<uint16_t>(current.height);
+        header.rects = static_cast<uint16_t>(rects.size());
+        header.compressed_size = static_cast<uint32_t>(compressed_size);
+        header.payload_size = static_cast<uint32_t>(payload.size());
+
+        auto const offset = m_bytes.load();
+        m_file.write(reinterpret_cast<char const *>(&header), sizeof header);
+        m_file.write(reinterpret_cast<char const *>(compressed.data()),
+                     compressed_size);
+        if (!m_file)
+          throw std::runtime_error("unable to write to " + m_path);
+        if (keyframe)
+          m_file.flush();
+
+        recording_index_entry_t entry{};
+        entry.offset = offset;
+        entry.timestamp_us = timestamp;
+        entry.sequence = header.sequence;
+        entry.type = header.type;
+        m_index.push_back(entry);
+
+        m_bytes = offset + sizeof header + compressed_size;
+        ++m_frames;
+        since_keyframe = keyframe ? 1 : since_keyframe + 1;
+        std::swap(previous, current);
+      }
+    } catch (std::exception const &e) {
+      spdlog::error("recording screen {}: {}", m_screenId, e.what());
+      if (!m_file)
+        break;
+    }
+
+    auto const now = std::chrono::steady_clock::now();
+    next_capture += interval;
+    if (next_capture < now)
+      next_capture = now;
+    std::unique_lock<std::mutex> lock{m_mutex};
+    m_stopCondition.wait_until(lock, next_capture,
+                               [this] { return m_stopped.load(); });
+  }
+}
+
+void screen_recorder_t::finish() {
+  if (!m_file)
+    return spdlog::error("recording {} is incomplete, no index", m_path);
+
+  details::recording_footer_t footer{};
+  footer.index_offset = m_bytes;
+  footer.frame_count = static_cast<uint32_t>(m_index.size());
+  memcpy(footer.magic, details::index_magic, sizeof footer.magic);
+  m_file.write(reinterpret_cast<char const *>(m_index.data()),
+               m_index.size() * sizeof(recording_index_entry_t));
+  m_file.write(reinterpret_cast<char const *>(&footer), sizeof footer);
+  m_file.close();
+  m_bytes += m_index.size() * sizeof(recording_index_entry_t) + sizeof footer;
+  spdlog::info("Recorded {} frames of screen {} to {}", m_frames.load(),
+               m_screenId, m_path);
+}
+
+recording_service_t *
+recording_service_t::create_global_instance(base_screen_t *screen,
+                                            std::string const &directory) {
+  static std::unique_ptr<recording_service_t> instance(new recording_service_t(
+      screen, directory.empty() ? std::filesystem::temp_directory_path()
+                                : std::filesystem::path(directory)));
+  return instance.get();
+}
+
+std::optional<recording_info_t>
+recording_service_t::start(int const screen_id,
+                           recording_options_t const &options) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  auto &recording = m_recordings[screen_id];
+  if (recording)
+    return std::nullopt;
+
+  std::filesystem::create_directories(m_directory);
+  auto const name = fmt::format("screen{}-{}.qadrec", screen_id,
+                                details::now_in_microseconds() / 1'000);
+  try {
+    recording = std::make_unique<screen_recorder_t>(
+        m_screen, screen_id, (m_directory / name).string(), options);
+  } catch (...) {
+    m_recordings.erase(screen_id);
+    throw;
+  }
+  return recording->info();
+}
+
+std::optional<recording_info_t> recording_service_t::stop(int const screen_id) {
+  std::unique_ptr<screen_recorder_t> recording{};
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto iter = m_recordings.find(screen_id);
+    if (iter == m_recordings.end())
+      return std::nullopt;
+    recording = std::move(iter->second);
+    m_recordings.erase(iter);
+  }
+  recording->stop();
+  return recording->info();
+}
+
+recording_reader_t::recording_reader_t(std::filesystem::path const &path)
+    : m_file(path, std::ios::in | std::ios::binary) {
+  using namespace details;
+  recording_file_header_t header{};
+  recording_footer_t footer{};
+  if (!m_file.read(reinterpret_cast<char *>(&header), sizeof header) ||
+      memcmp(header.magic, recording_magic, sizeof header.magic) != 0)
+    throw std::runtime_error("not a recording: " + path.string());
+
+  m_file.seekg(-static_cast<std::streamoff>(sizeof footer), std::ios::end);
+  if (!m_file.read(reinterpret_cast<char *>(&footer), sizeof footer) ||
+      memcmp(footer.magic, index_magic, sizeof footer.magic) != 0)
+    throw std::runtime_error("recording has no index: " + path.string());
+
+  m_index.resize(footer.frame_count);
+  m_file.seekg(static_cast<std::streamoff>(footer.index_offset));
+  if (!m_file.read(reinterpret_cast<char *>(m_index.data()),
+                   m_index.size() * sizeof(recording_index_entry_t)))
+    throw std::runtime_error("truncated recording index: " + path.string());
+}
+
+bool recording_reader_t::read_frame(std::size_t const n, raw_frame_t &frame) {
+  using namespace details;
+  if (n >= m_index.size())
+    return false;
+  auto keyframe = n;
+  while (keyframe > 0 && m_index[keyframe].type != 0)
+    --keyframe;
+  if (m_index[keyframe].type != 0)
+    return false;
+
+  std::vector<unsigned char> compressed{};
+  std::vector<unsigned char> payload{};
+  for (auto i = keyframe; i <= n; ++i) {
+    recording_frame_header_t header{};
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(m_index[i].offset));
+    if (!m_file.read(reinterpret_cast<char *>(&header), sizeof header))
+      return false;
+    compressed.resize(header.compressed_size);
+    payload.resize(header.payload_size);
+    if (!m_file.read(reinterpret_cast<char *>(compressed.data()),
+                     compressed.size()))
+      return false;
+    if (!compressed.empty()) {
+      auto const size = ZSTD_decompress(payload.data(), payload.size(),
+                                        compressed.data(), compressed.size());
+      if (ZSTD_isError(size) || size != payload.size())
+        return false;
+    }
+
+    auto const bytes_per_pixel = header.bpp / 8;
+    if (header.type == 0) {
+      frame.width = header.width;
+      frame.height = header.height;
+      frame.bpp = header.bpp;
+      frame.rgb = header.rgb;
+      frame.stride = frame.width * bytes_per_pixel;
+      frame.data.resize((size_t)frame.stride * frame.height);
+    }
+
+    size_t position = 0;
+    for (int r = 0; r < header.rects; ++r) {
+      recording_rect_t rect{};
+      if (position + sizeof rect > payload.size())
+        return false;
+      memcpy(&rect, payload.data() + position, sizeof rect);
+      position += sizeof rect;
+      auto const row_length = (size_t)rect.width * bytes_per_pixel;
+      if (rect.x + rect.width > frame.width ||
+          rect.y + rect.height > frame.height ||
+          position + row_length * rect.height > payload.size())
+        return false;
+      for (int row = rect.y; row < rect.y + rect.height; ++row) {
+        memcpy(frame.data.data() + (size_t)row * frame.stride +
+                   (size_t)rect.x * bytes_per_pixel,
+               payload.data() + position, row_length);
+        position += row_length;
+      }
+    }
+  }
+  return true;
+}
+} // namespace qadx
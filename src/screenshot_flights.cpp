@@ -0,0 +1,112 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "screenshot_flights.hpp"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+namespace qadx {
+screenshot_flights_t *
+screenshot_flights_t::create_global_instance(base_screen_t *screen,
+                                             frame_archive_t *archive) {
+  static std::unique_ptr<screenshot_flights_t> instance(
+      new screenshot_flights_t(screen, archive));
+  return instance.get();
+}
+
+void screenshot_flights_t::request(int const screen_id,
+                                   entity_tags_t known_hashes,
+                                   screenshot_callback_t callback) {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto [iter, inserted] = m_inFlight.try_emplace(screen_id);
+    iter->second.push_back({std::move(known_hashes), std::move(callback)});
+    if (!inserted) // somebody else is already capturing this screen
+      return;
+  }
+
+  try {
+    m_screen->grab_screenshot_async(
+        screen_id, [this, screen_id](grabbed_screenshot_t grabbed) {
+          complete(screen_id, std::move(grabbed));
+        });
+  } catch (std::exception const &e) {
+    spdlog::error("screenshot of screen {}: {}", screen_id, e.what());
+    complete(screen_id, grabbed_screenshot_t{});
+  }
+}
+
+void screenshot_flights_t::complete(int const screen_id,
+                                    grabbed_screenshot_t grabbed) {
+  screenshot_result_t result{};
+  result.captured = grabbed.captured;
+  result.hash = grabbed.hash;
+  auto &frame = grabbed.frame;
+
+  // no more waiters can join from here on, they'd start a new capture
+  std::vector<waiter_t> waiters{};
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto iter = m_inFlight.find(screen_id);
+    waiters = std::move(iter->second);
+    m_inFlight.erase(iter);
+  }
+
+  auto const has_frame = [hash = result.hash](waiter_t const &waiter) {
+    return waiter.known_hashes.matches(hash);
+  };
+  // some backends encode while grabbing, whether or not it's needed
+  shared_image_t image = std::move(grabbed.image);
+  if (result.captured && !image &&
+      !std::all_of(waiters.cbegin(), waiters.cend(), has_frame)) {
+    try {
+      auto encoded = make_pooled_image();
+      m_screen->encode_raw_frame(frame, *encoded);
+      image = std::move(encoded);
+    } catch (std::exception const &e) {
+      // waiters that already have the frame can still be answered
+      spdlog::error("encoding screen {}: {}", screen_id, e.what());
+    }
+  }
+
+  if (result.captured && m_archive) {
+    try {
+      result.frame_id = m_archive->store(result.hash, frame, image.get());
+    } catch (std::exception const &e) {
+      spdlog::error("archiving screen {}: {}", screen_id, e.what());
+    }
+  }
+
+  buffer_pool_t::instance().release(std::move(frame.data));
+
+  for (auto const &waiter : waiters) {
+    auto waiter_result = result;
+    waiter_result.not_modified = result.captured && has_frame(waiter);
+    if (!waiter_result.not_modified)
+      waiter_result.image = image;
+    waiter.callback(std::move(waiter_result));
+  }
+}
+} // namespace qadx
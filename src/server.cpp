@@ -38,10 +38,15 @@ server_t::server_t(net::io_context &context, runtime_args_t &&args_)
   auto const ip_address = "0.0.0.0";
   spdlog::info("Server running on {}:{}", ip_address, m_args.port);
   spdlog::info("Using '{}' for input devices",
-               m_args.input_backend == input_type_e::uinput ? "uinput"
-                                                            : "evdev");
+               m_args.input_backend == input_type_e::uinput   ? "uinput"
+               : m_args.input_backend == input_type_e::record ? "record"
+                                                              : "evdev");
   spdlog::info("Using '{}' for screen devices",
-               m_args.screen_backend == screen_type_e::kms ? "kms" : "ilm");
+               m_args.screen_backend == screen_type_e::kms         ? "kms"
+               : m_args.screen_backend == screen_type_e::synthetic ? "synthetic"
+               : m_args.screen_backend == screen_type_e::screencopy
+                   ? "screencopy"
+                   : "ilm");
 
   tcp::endpoint endpoint(net::ip::make_address(ip_address), m_args.port);
   ec = m_acceptor.open(endpoint.protocol(), ec);
@@ -0,0 +1,780 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "vnc_server.hpp"
+#include "frame_capture.hpp"
+#include "network_session.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <linux/input-event-codes.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+namespace qadx {
+namespace details {
+enum rfb_constant_e : int32_t {
+  RfbEncodingRaw = 0,
+  RfbEncodingCopyRect = 1,
+  RfbEncodingZRLE = 16,
+  RfbEncodingDesktopSize = -223,
+  RfbTileSize = 64,
+  RfbMinimumScrollRows = 16,
+  RfbMaximumCutText = 1'024 * 1'024,
+};
+
+enum rfb_client_message_e : uint8_t {
+  SetPixelFormat = 0,
+  SetEncodings = 2,
+  FramebufferUpdateRequest = 3,
+  KeyEvent = 4,
+  PointerEvent = 5,
+  ClientCutText = 6,
+};
+
+uint16_t read_u16(unsigned char const *p) { return (p[0] << 8) | p[1]; }
+
+uint32_t read_u32(unsigned char const *p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | p[3];
+}
+
+void append_u8(std::vector<unsigned char> &out, uint8_t const value) {
+  out.push_back(value);
+}
+
+void append_u16(std::vector<unsigned char> &out, uint16_t const value) {
+  out.push_back(value >> 8);
+  out.push_back(value & 0xFF);
+}
+
+void append_u32(std::vector<unsigned char> &out, uint32_t const value) {
+  append_u16(out, value >> 16);
+  append_u16(out, value & 0xFFFF);
+}
+
+void append_rect_header(std::vector<unsigned char> &out,
+                        frame_rect_t const &rect, int32_t const encoding) {
+  append_u16(out, rect.x);
+  append_u16(out, rect.y);
+  append_u16(out, rect.width);
+  append_u16(out, rect.height);
+  append_u32(out, static_cast<uint32_t>(encoding));
+}
+
+// X11 keysyms (as sent by VNC viewers) to linux input key codes
+int keysym_to_key_code(uint32_t const keysym) {
+  static std::unordered_map<uint32_t, int> const key_map = [] {
+    std::unordered_map<uint32_t, int> result{
+        {' ', KEY_SPACE},       {'-', KEY_MINUS},
+        {'=', KEY_EQUAL},       {'[', KEY_LEFTBRACE},
+        {']', KEY_RIGHTBRACE},  {';', KEY_SEMICOLON},
+        {'\'', KEY_APOSTROPHE}, {'`', KEY_GRAVE},
+        {'\\', KEY_BACKSLASH},  {',', KEY_COMMA},
+        {'.', KEY_DOT},         {'/', KEY_SLASH},
+        {0xff08, KEY_BACKSPACE}, {0xff09, KEY_TAB},
+        {0xff0d, KEY_ENTER},    {0xff1b, KEY_ESC},
+        {0xffff, KEY_DELETE},   {0xff50, KEY_HOME},
+        {0xff51, KEY_LEFT},     {0xff52, KEY_UP},
+        {0xff53, KEY_RIGHT},    {0xff54, KEY_DOWN},
+        {0xff55, KEY_PAGEUP},   {0xff56, KEY_PAGEDOWN},
+        {0xff57, KEY_END},      {0xffe1, KEY_LEFTSHIFT},
+        {0xffe2, KEY_RIGHTSHIFT}, {0xffe3, KEY_LEFTCTRL},
+        {0xffe4, KEY_RIGHTCTRL}, {0xffe9, KEY_LEFTALT},
+        {0xffea, KEY_RIGHTALT}, {0xffe5, KEY_CAPSLOCK},
+    };
+    std::string_view const rows[] = {"qwertyuiop", "asdfghjkl", "zxcvbnm"};
+    int const row_start[] = {KEY_Q, KEY_A, KEY_Z};
+    for (int row = 0; row < 3; ++row) {
+      for (size_t i = 0; i < rows[row].size(); ++i) {
+        result[rows[row][i]] = row_start[row] + (int)i;
+        result[rows[row][i] - 'a' + 'A'] = row_start[row] + (int)i;
+      }
+    }
+    result['0'] = KEY_0;
+    for (uint32_t digit = '1'; digit <= '9'; ++digit)
+      result[digit] = KEY_1 + int(digit - '1');
+    for (uint32_t f = 0; f < 10; ++f)
+      result[0xffbe + f] = KEY_F1 + (int)f;
+    return result;
+  }();
+
+  auto const iter = key_map.find(keysym);
+  return iter == key_map.cend() ? 0 : iter->second;
+}
+
+std::vector<std::size_t> hash_rows(raw_frame_t const &frame) {
+  std::vector<std::size_t> hashes(frame.height);
+  auto const row_length = (size_t)frame.width * frame.bpp / 8;
+  for (int y = 0; y < frame.height; ++y) {
+    std::string_view const row{
+        reinterpret_cast<char const *>(frame.data.data()) +
+            (size_t)y * frame.stride,
+        row_length};
+    hashes[y] = std::hash<std::string_view>{}(row);
+  }
+  return hashes;
+}
+} // namespace details
+
+vnc_session_t::vnc_session_t(tcp::socket &&socket, runtime_args_t const &args)
+    : m_socket(std::move(socket)), m_timer(m_socket.get_executor()),
+      m_args(args) {}
+
+vnc_session_t::~vnc_session_t() {
+  if (m_zrleStreamInitialized)
+    deflateEnd(&m_zrleStream);
+  spdlog::info("VNC session completed...");
+}
+
+template <typename Handler>
+void vnc_session_t::read_exactly(std::size_t const size, Handler &&handler) {
+  m_readBuffer.resize(size);
+  net::async_read(m_socket, net::buffer(m_readBuffer),
+                  [self = shared_from_this(),
+                   handler = std::forward<Handler>(handler)](
+                      beast::error_code const ec, std::size_t) {
+                    if (ec)
+                      return self->close_connection();
+                    handler();
+                  });
+}
+
+template <typename Handler>
+void vnc_session_t::write_buffer(Handler &&handler) {
+  m_writing = true;
+  net::async_write(m_socket, net::buffer(m_writeBuffer),
+                   [self = shared_from_this(),
+                    handler = std::forward<Handler>(handler)](
+                       beast::error_code const ec, std::size_t) {
+                     self->m_writing = false;
+                     if (ec)
+                       return self->close_connection();
+                     handler();
+                   });
+}
+
+void vnc_session_t::run() {
+  try {
+    m_screen = get_screen_object(m_args);
+    m_input = get_input_object(m_args);
+  } catch (std::exception const &e) {
+    spdlog::error("VNC: {}", e.what());
+  }
+
+  if (!m_screen || !m_screen->grab_raw_frame(m_currentFrame, m_args.vnc_screen))
+    return spdlog::error("VNC: unable to get frame of screen {}",
+                         m_args.vnc_screen);
+  if (m_currentFrame.bpp != 32)
+    return spdlog::error("VNC: only 32bpp frame buffers can be served");
+
+  if (m_currentFrame.rgb)
+    std::swap(m_settings.pixel_format.red_shift,
+              m_settings.pixel_format.blue_shift);
+
+  std::string_view const version = "RFB 003.008\n";
+  m_writeBuffer.assign(version.begin(), version.end());
+  write_buffer([this] { read_exactly(12, [this] { on_version_read(); }); });
+}
+
+void vnc_session_t::on_version_read() {
+  std::string_view const version{
+      reinterpret_cast<char const *>(m_readBuffer.data()), 12};
+  if (version.substr(0, 8) != "RFB 003.")
+    return close_connection();
+
+  m_protocolMinor = std::min(8, std::atoi(version.substr(8, 3).data()));
+  m_writeBuffer.clear();
+  if (m_protocolMinor < 7) {
+    // 3.3: the server decides, security type "None"
+    details::append_u32(m_writeBuffer, 1);
+    return write_buffer(
+        [this] { read_exactly(1, [this] { on_client_init_read(); }); });
+  }
+
+  details::append_u8(m_writeBuffer, 1); // number of security types
+  details::append_u8(m_writeBuffer, 1); // None
+  write_buffer(
+      [this] { read_exactly(1, [this] { on_security_type_read(); }); });
+}
+
+void vnc_session_t::on_security_type_read() {
+  if (m_readBuffer[0] != 1)
+    return close_connection();
+
+  if (m_protocolMinor < 8)
+    return read_exactly(1, [this] { on_client_init_read(); });
+
+  m_writeBuffer.clear();
+  details::append_u32(m_writeBuffer, 0); // SecurityResult OK
+  write_buffer([this] { read_exactly(1, [this] { on_client_init_read(); }); });
+}
+
+void vnc_session_t::on_client_init_read() {
+  std::string_view const name = "qadx";
+  auto const &format = m_settings.pixel_format;
+
+  m_writeBuffer.clear();
+  details::append_u16(m_writeBuffer, m_currentFrame.width);
+  details::append_u16(m_writeBuffer, m_currentFrame.height);
+  details::append_u8(m_writeBuffer, format.bpp);
+  details::append_u8(m_writeBuffer, format.depth);
+  details::append_u8(m_writeBuffer, format.big_endian);
+  details::append_u8(m_writeBuffer, format.true_colour);
+  details::append_u16(m_writeBuffer, format.red_max);
+  details::append_u16(m_writeBuffer, format.green_max);
+  details::append_u16(m_writeBuffer, format.blue_max);
+  details::append_u8(m_writeBuffer, format.red_shift);
+  details::append_u8(m_writeBuffer, format.green_shift);
+  details::append_u8(m_writeBuffer, format.blue_shift);
+  m_writeBuffer.insert(m_writeBuffer.end(), 3, 0); // padding
+  details::append_u32(m_writeBuffer, name.size());
+  m_writeBuffer.insert(m_writeBuffer.end(), name.begin(), name.end());
+
+  write_buffer([this] {
+    read_message();
+    schedule_update();
+  });
+}
+
+void vnc_session_t::read_message() {
+  read_exactly(1, [this] { on_message_type_read(); });
+}
+
+void vnc_session_t::on_message_type_read() {
+  switch (m_readBuffer[0]) {
+  case details::SetPixelFormat:
+    return read_exactly(19, [this] { on_set_pixel_format(); });
+  case details::SetEncodings:
+    return read_exactly(3, [this] {
+      auto const count = details::read_u16(m_readBuffer.data() + 1);
+      read_exactly(count * 4u, [this, count] { on_set_encodings(count); });
+    });
+  case details::FramebufferUpdateRequest:
+    return read_exactly(9, [this] { on_update_request(); });
+  case details::KeyEvent:
+    return read_exactly(7, [this] { on_key_event(); });
+  case details::PointerEvent:
+    return read_exactly(5, [this] { on_pointer_event(); });
+  case details::ClientCutText:
+    return read_exactly(7, [this] {
+      auto const length = details::read_u32(m_readBuffer.data() + 3);
+      if (length > details::RfbMaximumCutText)
+        return close_connection();
+      // the clipboard isn't shared with the device, drop the text
+      read_exactly(length, [this] { read_message(); });
+    });
+  default:
+    spdlog::error("VNC: unsupported client message {}", m_readBuffer[0]);
+    return close_connection();
+  }
+}
+
+void vnc_session_t::on_set_pixel_format() {
+  auto const p = m_readBuffer.data() + 3;
+  details::rfb_pixel_format_t format{};
+  format.bpp = p[0];
+  format.depth = p[1];
+  format.big_endian = p[2];
+  format.true_colour = p[3];
+  format.red_max = details::read_u16(p + 4);
+  format.green_max = details::read_u16(p + 6);
+  format.blue_max = details::read_u16(p + 8);
+  format.red_shift = p[10];
+  format.green_shift = p[11];
+  format.blue_shift = p[12];
+
+  if (!format.true_colour ||
+      (format.bpp != 8 && format.bpp != 16 && format.bpp != 32)) {
+    spdlog::error("VNC: colour map pixel formats are not supported");
+    return close_connection();
+  }
+  m_settings.pixel_format = format;
+  m_fullUpdateRequested = true;
+  read_message();
+}
+
+void vnc_session_t::on_set_encodings(std::size_t const count) {
+  auto &settings = m_settings;
+  settings.preferred_encoding = details::RfbEncodingRaw;
+  settings.copy_rect_supported = settings.desktop_size_supported = false;
+  bool preferred_found = false;
+  for (std::size_t i = 0; i < count; ++i) {
+    auto const encoding =
+        static_cast<int32_t>(details::read_u32(m_readBuffer.data() + i * 4));
+    if (encoding == details::RfbEncodingCopyRect) {
+      settings.copy_rect_supported = true;
+    } else if (encoding == details::RfbEncodingDesktopSize) {
+      settings.desktop_size_supported = true;
+    } else if (!preferred_found && (encoding == details::RfbEncodingZRLE ||
+                                    encoding == details::RfbEncodingRaw)) {
+      settings.preferred_encoding = encoding;
+      preferred_found = true;
+    }
+  }
+  read_message();
+}
+
+void vnc_session_t::on_update_request() {
+  bool const incremental = m_readBuffer[0] != 0;
+  m_updateRequested = true;
+  if (!incremental)
+    m_fullUpdateRequested = true;
+  read_message();
+}
+
+void vnc_session_t::on_key_event() {
+  bool const down = m_readBuffer[0] != 0;
+  auto const keysym = details::read_u32(m_readBuffer.data() + 3);
+  // presses and releases are forwarded as they come, so that modifiers
+  // stay held while the keys they modify are typed
+  if (auto const key_code = details::keysym_to_key_code(keysym);
+      key_code && m_input) {
+    try {
+      utils::event_frame_t frame{};
+      frame.add(EV_KEY, (uint16_t)key_code, down ? 1 : 0);
+      if (!m_input->send_frame(frame, m_args.vnc_keyboard_event))
+        spdlog::error("VNC: unable to send key {}", key_code);
+    } catch (std::exception const &e) {
+      spdlog::error("VNC: {}", e.what());
+    }
+  }
+  read_message();
+}
+
+void vnc_session_t::on_pointer_event() {
+  uint8_t const mask = m_readBuffer[0];
+  int const x = details::read_u16(m_readBuffer.data() + 1);
+  int const y = details::read_u16(m_readBuffer.data() + 3);
+  int const event = m_args.vnc_pointer_event;
+
+  if (m_input) {
+    try {
+      bool const was_down = m_buttonMask & 1;
+      bool const is_down = mask & 1;
+      if (is_down || was_down)
+        m_input->move(x, y, event);
+      if (is_down != was_down)
+        m_input->button(is_down ? BUTTON_DOWN : BUTTON_UP, event);
+    } catch (std::exception const &e) {
+      spdlog::error("VNC: {}", e.what());
+    }
+  }
+  m_buttonMask = mask;
+  read_message();
+}
+
+void vnc_session_t::schedule_update() {
+  m_timer.expires_after(std::chrono::milliseconds(1'000 / m_args.vnc_fps));
+  m_timer.async_wait([self = shared_from_this()](beast::error_code const ec) {
+    self->on_timer_expired(ec);
+  });
+}
+
+void vnc_session_t::on_timer_expired(beast::error_code const ec) {
+  if (ec || m_closed)
+    return;
+
+  if (m_updateRequested && !m_writing) {
+    // the grab and the encode happen on a worker, only the write comes back
+    // to the socket; requests that come in meanwhile are for the next update
+    bool const full_update = m_fullUpdateRequested;
+    m_updateRequested = m_fullUpdateRequested = false;
+    m_updateSettings = m_settings;
+    m_writing = true;
+    net::post(capture_pool(), [self = shared_from_this(), full_update] {
+      bool failed = false;
+      bool built = false;
+      try {
+        built = self->build_update(full_update);
+      } catch (std::exception const &e) {
+        spdlog::error("VNC: {}", e.what());
+        failed = true;
+      }
+      net::post(self->m_socket.get_executor(), [self, failed, built] {
+        self->on_update_built(failed, built);
+      });
+    });
+  }
+  schedule_update();
+}
+
+void vnc_session_t::on_update_built(bool const failed, bool const built) {
+  m_writing = false;
+  if (failed)
+    return close_connection();
+  if (m_closed)
+    return;
+  if (!built) { // nothing changed, the request stays outstanding
+    m_updateRequested = true;
+    return;
+  }
+  write_buffer([] {});
+}
+
+bool vnc_session_t::build_update(bool const full_update) {
+  if (!m_screen->grab_raw_frame(m_currentFrame, m_args.vnc_screen)) {
+    throw std::runtime_error(fmt::format("unable to get frame of screen {}",
+                                         m_args.vnc_screen));
+  }
+
+  auto const &frame = m_currentFrame;
+  bool const resized = !m_clientFrame.data.empty() &&
+                       (frame.width != m_clientFrame.width ||
+                        frame.height != m_clientFrame.height);
+  if (resized && !m_updateSettings.desktop_size_supported)
+    throw std::runtime_error("screen was resized and the client can't follow");
+
+  frame_rect_t const whole_frame{0, 0, frame.width, frame.height};
+  std::vector<frame_rect_t> copy_rects{};
+  std::vector<frame_rect_t> rects{};
+  if (full_update || resized || m_clientFrame.data.empty() ||
+      frame.stride != m_clientFrame.stride || frame.rgb != m_clientFrame.rgb) {
+    rects.push_back(whole_frame);
+  } else {
+    if (m_updateSettings.copy_rect_supported)
+      apply_scroll(copy_rects);
+    rects = find_dirty_tiles(m_clientFrame, frame, details::RfbTileSize);
+    if (rects.empty() && copy_rects.empty())
+      return false;
+  }
+
+  m_writeBuffer.clear();
+  details::append_u8(m_writeBuffer, 0); // FramebufferUpdate
+  details::append_u8(m_writeBuffer, 0); // padding
+  details::append_u16(m_writeBuffer, (resized ? 1 : 0) + copy_rects.size() / 2 +
+                                         rects.size());
+  if (resized)
+    details::append_rect_header(m_writeBuffer, whole_frame,
+                                details::RfbEncodingDesktopSize);
+  // copy_rects holds (destination, source) pairs
+  for (size_t i = 0; i + 1 < copy_rects.size(); i += 2) {
+    details::append_rect_header(m_writeBuffer, copy_rects[i],
+                                details::RfbEncodingCopyRect);
+    details::append_u16(m_writeBuffer, copy_rects[i + 1].x);
+    details::append_u16(m_writeBuffer, copy_rects[i + 1].y);
+  }
+  for (auto const &rect : rects)
+    append_rect(rect);
+
+  std::swap(m_clientFrame, m_currentFrame);
+  return true;
+}
+
+// Detects a vertical scroll of (part of) the screen by matching full rows of
+// the new frame against the client's framebuffer. When found, the copy is
+// applied to our model of the client framebuffer so that the dirty tile pass
+// only sends what the CopyRect didn't already cover.
+bool vnc_session_t::apply_scroll(std::vector<frame_rect_t> &copy_rects) {
+  auto const &frame = m_currentFrame;
+  auto const old_rows = details::hash_rows(m_clientFrame);
+  auto const new_rows = details::hash_rows(frame);
+
+  std::unordered_map<std::size_t, int> old_row_index{};
+  for (int y = frame.height - 1; y >= 0; --y)
+    old_row_index[old_rows[y]] = y;
+
+  std::unordered_map<int, int> votes{};
+  for (int y = 0; y < frame.height; ++y) {
+    if (new_rows[y] == old_rows[y])
+      continue;
+    if (auto iter = old_row_index.find(new_rows[y]);
+        iter != old_row_index.end()) {
+      ++votes[y - iter->second];
+    }
+  }
+
+  auto const best = std::max_element(
+      votes.cbegin(), votes.cend(),
+      [](auto const &a, auto const &b) { return a.second < b.second; });
+  if (best == votes.cend() || best->second < details::RfbMinimumScrollRows)
+    return false;
+
+  int const delta = best->first;
+  int run_start = -1;
+  int best_start = 0;
+  int best_length = 0;
+  for (int y = 0; y <= frame.height; ++y) {
+    int const source_row = y - delta;
+    bool const matches = y < frame.height && source_row >= 0 &&
+                         source_row < frame.height &&
+                         new_rows[y] == old_rows[source_row];
+    if (matches && run_start < 0) {
+      run_start = y;
+    } else if (!matches && run_start >= 0) {
+      if (y - run_start > best_length) {
+        best_start = run_start;
+        best_length = y - run_start;
+      }
+      run_start = -1;
+    }
+  }
+  if (best_length < details::RfbMinimumScrollRows)
+    return false;
+
+  copy_rects.push_back({0, best_start, frame.width, best_length});
+  copy_rects.push_back({0, best_start - delta, frame.width, best_length});
+
+  auto &client = m_clientFrame.data;
+  auto const block = client.begin() + (best_start - delta) * frame.stride;
+  qad_screen_buffer_t rows(block, block + best_length * frame.stride);
+  std::copy(rows.cbegin(), rows.cend(),
+            client.begin() + best_start * frame.stride);
+  return true;
+}
+
+bool vnc_session_t::pixel_format_is_native() const {
+  auto const &format = m_updateSettings.pixel_format;
+  int const red_shift = m_currentFrame.rgb ? 0 : 16;
+  return format.bpp == 32 && !format.big_endian && format.red_max == 255 &&
+         format.green_max == 255 && format.blue_max == 255 &&
+         format.red_shift == red_shift && format.green_shift == 8 &&
+         format.blue_shift == 16 - red_shift;
+}
+
+uint32_t vnc_session_t::translate_pixel(unsigned char const *pixel) const {
+  auto const &format = m_updateSettings.pixel_format;
+  uint32_t const red = m_currentFrame.rgb ? pixel[0] : pixel[2];
+  uint32_t const green = pixel[1];
+  uint32_t const blue = m_currentFrame.rgb ? pixel[2] : pixel[0];
+  return ((red * format.red_max + 127) / 255) << format.red_shift |
+         ((green * format.green_max + 127) / 255) << format.green_shift |
+         ((blue * format.blue_max + 127) / 255) << format.blue_shift;
+}
+
+void vnc_session_t::append_value(buffer_t &out, uint32_t const value,
+                                 bool const compact) const {
+  auto const &format = m_updateSettings.pixel_format;
+  int const bytes = format.bpp / 8;
+  unsigned char serialized[4]{};
+  for (int i = 0; i < bytes; ++i) {
+    int const shift = format.big_endian ? 8 * (bytes - 1 - i) : 8 * i;
+    serialized[i] = (value >> shift) & 0xFF;
+  }
+
+  if (!compact || bytes != 4 || format.depth > 24)
+    return out.insert(out.end(), serialized, serialized + bytes), void();
+
+  // ZRLE's CPIXEL: the 3 bytes that actually hold colour information
+  auto const fits_in = [&format](int const bits) {
+    auto const top = [bits](uint32_t max, uint8_t shift) {
+      return (uint64_t(max) << shift) < (uint64_t(1) << bits);
+    };
+    return top(format.red_max, format.red_shift) &&
+           top(format.green_max, format.green_shift) &&
+           top(format.blue_max, format.blue_shift);
+  };
+  int skip;
+  if (fits_in(24))
+    skip = format.big_endian ? 1 : 0;
+  else
+    skip = format.big_endian ? 0 : 1;
+  out.insert(out.end(), serialized + skip, serialized + skip + 3);
+}
+
+void vnc_session_t::append_rect(frame_rect_t const &rect) {
+  if (m_updateSettings.preferred_encoding == details::RfbEncodingZRLE)
+    return append_zrle_rect(rect);
+  append_raw_rect(rect);
+}
+
+void vnc_session_t::append_raw_rect(frame_rect_t const &rect) {
+  details::append_rect_header(m_writeBuffer, rect, details::RfbEncodingRaw);
+  auto const &frame = m_currentFrame;
+
+  if (pixel_format_is_native()) {
+    auto const row_length = (size_t)rect.width * 4;
+    for (int y = rect.y; y < rect.y + rect.height; ++y) {
+      auto const row =
+          frame.data.data() + (size_t)y * frame.stride + (size_t)rect.x * 4;
+      m_writeBuffer.insert(m_writeBuffer.end(), row, row + row_length);
+    }
+    return;
+  }
+
+  auto const bpp = m_updateSettings.pixel_format.bpp;
+  m_writeBuffer.reserve(m_writeBuffer.size() +
+                        (size_t)rect.width * rect.height * bpp / 8);
+  for (int y = rect.y; y < rect.y + rect.height; ++y) {
+    auto row = frame.data.data() + (size_t)y * frame.stride;
+    for (int x = rect.x; x < rect.x + rect.width; ++x)
+      append_value(m_writeBuffer, translate_pixel(row + x * 4), false);
+  }
+}
+
+void vnc_session_t::append_zrle_rect(frame_rect_t const &rect) {
+  auto const &frame = m_currentFrame;
+  buffer_t tiles{};
+  std::vector<uint32_t> pixels{};
+  std::vector<uint32_t> palette{};
+  pixels.reserve(details::RfbTileSize * details::RfbTileSize);
+
+  for (int tile_y = rect.y; tile_y < rect.y + rect.height;
+       tile_y += details::RfbTileSize) {
+    int const tile_height =
+        std::min<int>(details::RfbTileSize, rect.y + rect.height - tile_y);
+    for (int tile_x = rect.x; tile_x < rect.x + rect.width;
+         tile_x += details::RfbTileSize) {
+      int const tile_width =
+          std::min<int>(details::RfbTileSize, rect.x + rect.width - tile_x);
+
+      pixels.clear();
+      palette.clear();
+      for (int y = tile_y; y < tile_y + tile_height; ++y) {
+        auto const row = frame.data.data() + (size_t)y * frame.stride;
+        for (int x = tile_x; x < tile_x + tile_width; ++x) {
+          auto const value = translate_pixel(row + x * 4);
+          pixels.push_back(value);
+          if (palette.size() <= 16 &&
+              std::find(palette.cbegin(), palette.cend(), value) ==
+                  palette.cend()) {
+            palette.push_back(value);
+          }
+        }
+      }
+
+      if (palette.size() == 1) { // solid tile
+        details::append_u8(tiles, 1);
+        append_value(tiles, palette[0], true);
+      } else if (palette.size() <= 16) { // packed palette
+        details::append_u8(tiles, palette.size());
+        for (auto const colour : palette)
+          append_value(tiles, colour, true);
+        int const bits = palette.size() == 2 ? 1 : palette.size() <= 4 ? 2 : 4;
+        for (int y = 0; y < tile_height; ++y) {
+          uint8_t byte = 0;
+          int used = 0;
+          for (int x = 0; x < tile_width; ++x) {
+            auto const colour = pixels[y * tile_width + x];
+            auto const index =
+                std::find(palette.cbegin(), palette.cend(), colour) -
+                palette.cbegin();
+            byte |= index << (8 - bits - used);
+            used += bits;
+            if (used == 8) {
+              tiles.push_back(byte);
+              byte = 0;
+              used = 0;
+            }
+          }
+          if (used)
+            tiles.push_back(byte);
+        }
+      } else { // raw CPIXELs
+        details::append_u8(tiles, 0);
+        for (auto const colour : pixels)
+          append_value(tiles, colour, true);
+      }
+    }
+  }
+
+  if (!m_zrleStreamInitialized) {
+    if (deflateInit(&m_zrleStream, Z_BEST_SPEED) != Z_OK)
+      throw std::runtime_error("unable to initialize ZRLE stream");
+    m_zrleStreamInitialized = true;
+  }
+
+  details::append_rect_header(m_writeBuffer, rect, details::RfbEncodingZRLE);
+  auto const length_offset = m_writeBuffer.size();
+  details::append_u32(m_writeBuffer, 0);
+  auto const data_offset = m_writeBuffer.size();
+
+  // one zlib stream is kept for the whole connection, as RFB requires
+  m_zrleStream.next_in = tiles.data();
+  m_zrleStream.avail_in = tiles.size();
+  do {
+    auto const chunk = deflateBound(&m_zrleStream, m_zrleStream.avail_in) + 64;
+    auto const offset = m_writeBuffer.size();
+    m_writeBuffer.resize(offset + chunk);
+    m_zrleStream.next_out = m_writeBuffer.data() + offset;
+    m_zrleStream.avail_out = chunk;
+    if (deflate(&m_zrleStream, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+      throw std::runtime_error("unable to compress ZRLE data");
+    m_writeBuffer.resize(m_writeBuffer.size() - m_zrleStream.avail_out);
+  } while (m_zrleStream.avail_out == 0);
+
+  auto const length = m_writeBuffer.size() - data_offset;
+  for (int i = 0; i < 4; ++i)
+    m_writeBuffer[length_offset + i] = (length >> (8 * (3 - i))) & 0xFF;
+}
+
+void vnc_session_t::close_connection() {
+  if (m_closed)
+    return;
+  m_closed = true;
+  m_timer.cancel();
+  beast::error_code ec{};
+  (void)m_socket.shutdown(net::socket_base::shutdown_both, ec);
+  (void)m_socket.close(ec);
+}
+
+vnc_server_t::vnc_server_t(net::io_context &context, runtime_args_t args)
+    : m_ioContext(context), m_acceptor(net::make_strand(m_ioContext)),
+      m_args(std::move(args)) {
+  beast::error_code ec{};
+  tcp::endpoint endpoint(net::ip::make_address("0.0.0.0"), m_args.vnc_port);
+  if (m_acceptor.open(endpoint.protocol(), ec) ||
+      m_acceptor.set_option(net::socket_base::reuse_address(true), ec) ||
+      m_acceptor.bind(endpoint, ec) ||
+      m_acceptor.listen(net::socket_base::max_listen_connections, ec)) {
+    spdlog::error("Could not start VNC server: {}", ec.message());
+    return;
+  }
+
+  spdlog::info("VNC server running on 0.0.0.0:{}, serving screen {}",
+               m_args.vnc_port, m_args.vnc_screen);
+  m_isOpen = true;
+}
+
+bool vnc_server_t::run() {
+  if (m_isOpen)
+    accept_connections();
+  return m_isOpen;
+}
+
+void vnc_server_t::on_connection_accepted(beast::error_code const ec,
+                                          tcp::socket socket) {
+  if (ec)
+    return spdlog::error("error on VNC connection: {}", ec.message());
+
+  std::make_shared<vnc_session_t>(std::move(socket), m_args)->run();
+  accept_connections();
+}
+
+void vnc_server_t::accept_connections() {
+  m_acceptor.async_accept(
+      net::make_strand(m_ioContext),
+      [self = shared_from_this()](beast::error_code const ec,
+                                  tcp::socket socket) {
+        return self->on_connection_accepted(ec, std::move(socket));
+      });
+}
+} // namespace qadx
@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2024 Codethink Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "websocket_session.hpp"
+#include "frame_capture.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/websocket.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+namespace qadx {
+namespace details {
+enum frame_type_e : uint8_t { KeyFrame = 0, DeltaFrame = 1 };
+
+template <typename T> void append_le(qad_screen_buffer_t &out, T value) {
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out.push_back(static_cast<unsigned char>(value & 0xFF));
+    value >>= 8;
+  }
+}
+
+void append_compressed_rect(qad_screen_buffer_t &out, raw_frame_t const &frame,
+                            frame_rect_t const &rect) {
+  auto const bytes_per_pixel = frame.bpp / 8;
+  auto const row_length = (size_t)rect.width * bytes_per_pixel;
+  qad_screen_buffer_t pixels(row_length * rect.height);
+  for (int row = 0; row < rect.height; ++row) {
+    memcpy(pixels.data() + row * row_length,
+           frame.data.data() + (size_t)(rect.y + row) * frame.stride +
+               (size_t)rect.x * bytes_per_pixel,
+           row_length);
+  }
+
+  append_le<uint16_t>(out, rect.x);
+  append_le<uint16_t>(out, rect.y);
+  append_le<uint16_t>(out, rect.width);
+  append_le<uint16_t>(out, rect.height);
+  auto const size_offset = out.size();
+  append_le<uint32_t>(out, 0);
+
+  auto compressed_size = compressBound(pixels.size());
+  auto const data_offset = out.size();
+  out.resize(data_offset + compressed_size);
+  if (compress2(out.data() + data_offset, &compressed_size, pixels.data(),
+                pixels.size(), Z_BEST_SPEED) != Z_OK) {
+    throw std::runtime_error("unable to compress frame rectangle");
+  }
+  out.resize(data_offset + compressed_size);
+  for (size_t i = 0; i < sizeof(uint32_t); ++i)
+    out[size_offset + i] = (compressed_size >> (8 * i)) & 0xFF;
+}
+} // namespace details
+
+websocket_session_t::websocket_session_t(beast::tcp_stream &&stream,
+                                         base_screen_t *screen,
+                                         int const screen_id,
+                                         websocket_stream_options_t options)
+    : m_websocket(std::move(stream)), m_timer(m_websocket.get_executor()),
+      m_screen(screen), m_screenId(screen_id), m_options(options),
+      m_interval(std::chrono::microseconds(1'000'000 / options.fps)) {}
+
+websocket_session_t::~websocket_session_t() {
+  spdlog::info("websocket stream of screen {} ended after {} frames",
+               m_screenId, m_sequence);
+}
+
+void websocket_session_t::run(http::request<http::string_body> const &request) {
+  beast::get_lowest_layer(m_websocket).expires_never();
+  m_websocket.set_option(
+      websocket::stream_base::timeout::suggested(beast::role_type::server));
+  m_websocket.set_option(websocket::stream_base::decorator(
+      [](websocket::response_type &response) {
+        response.set(http::field::server, "qadx-server");
+      }));
+  m_websocket.binary(true);
+  m_websocket.async_accept(
+      request, [self = shared_from_this()](beast::error_code const ec) {
+        self->on_accepted(ec);
+      });
+}
+
+void websocket_session_t::on_accepted(beast::error_code const ec) {
+  if (ec)
+    return spdlog::error("websocket handshake failed: {}", ec.message());
+
+  read_client_message();
+  m_timer.expires_after(std::chrono::steady_clock::duration::zero());
+  m_timer.async_wait(
+      [self = shared_from_this()](beast::error_code const err_c) {
+        self->on_timer_expired(err_c);
+      });
+}
+
+void websocket_session_t::read_client_message() {
+  m_readBuffer.clear();
+  m_websocket.async_read(m_readBuffer, [self = shared_from_this()](
+                                           beast::error_code const ec,
+                                           std::size_t) {
+    self->on_client_message(ec);
+  });
+}
+
+void websocket_session_t::on_client_message(beast::error_code const ec) {
+  if (ec) {
+    if (ec != websocket::error::closed && ec != net::error::eof)
+      spdlog::error("websocket read failed: {}", ec.message());
+    m_closed = true;
+    m_timer.cancel();
+    return;
+  }
+
+  try {
+    auto const message = nlohmann::json::parse(
+        beast::buffers_to_string(m_readBuffer.data()));
+    if (auto const iter = message.find("ack"); iter != message.end()) {
+      // acks may arrive out of order, only ever move forward
+      auto const ack = iter->get<uint32_t>();
+      if (ack - m_lastAcked <= m_sequence - m_lastAcked)
+        m_lastAcked = ack;
+    }
+    if (auto const iter = message.find("keyframe");
+        iter != message.end() && iter->get<bool>()) {
+      m_keyframeRequested = true;
+    }
+  } catch (std::exception const &e) {
+    spdlog::warn("ignoring invalid websocket message: {}", e.what());
+  }
+  read_client_message();
+}
+
+void websocket_session_t::schedule_next_frame() {
+  auto const now = std::chrono::steady_clock::now();
+  auto next_tick = m_timer.expiry() + m_interval;
+  if (next_tick < now)
+    next_tick = now + m_interval;
+  m_timer.expires_at(next_tick);
+  m_timer.async_wait([self = shared_from_this()](beast::error_code const ec) {
+    self->on_timer_expired(ec);
+  });
+}
+
+void websocket_session_t::on_timer_expired(beast::error_code const ec) {
+  if (ec || m_closed)
+    return;
+
+  auto const in_flight = m_sequence - m_lastAcked;
+  if (m_writing || in_flight >= (uint32_t)m_options.window)
+    return schedule_next_frame();
+
+  // the grab and the encode happen on a worker, only the write comes back
+  // to the stream; the state client messages touch is handed over by value
+  m_writing = true;
+  net::post(capture_pool(), [self = shared_from_this(),
+                             keyframe_requested = m_keyframeRequested,
+                             sequence = m_sequence + 1] {
+    bool failed = false;
+    bool built = false;
+    bool is_keyframe = false;
+    try {
+      if (!self->m_screen->grab_raw_frame(self->m_currentFrame,
+                                          self->m_screenId)) {
+        spdlog::error("unable to get frame of screen {}", self->m_screenId);
+        failed = true;
+      } else {
+        built = self->build_frame_message(keyframe_requested, sequence,
+                                          is_keyframe);
+      }
+    } catch (std::exception const &e) {
+      spdlog::error(e.what());
+      failed = true;
+    }
+    if (built)
+      std::swap(self->m_currentFrame, self->m_previousFrame);
+    net::post(self->m_websocket.get_executor(),
+              [self, failed, built, is_keyframe] {
+                self->on_frame_built(failed, built, is_keyframe);
+              });
+  });
+  schedule_next_frame();
+}
+
+void websocket_session_t::on_frame_built(bool const failed, bool const built,
+                                         bool const is_keyframe) {
+  if (failed || m_closed) {
+    m_writing = false;
+    if (!m_closed)
+      close_stream();
+    return;
+  }
+  if (!built) { // nothing changed on screen
+    m_writing = false;
+    return;
+  }
+
+  ++m_sequence;
+  if (is_keyframe)
+    m_keyframeRequested = false;
+  m_websocket.async_write(
+      net::buffer(m_message),
+      [self = shared_from_this()](beast::error_code const err_c, std::size_t) {
+        self->on_frame_written(err_c);
+      });
+}
+
+void websocket_session_t::on_frame_written(beast::error_code const ec) {
+  m_writing = false;
+  if (ec) {
+    spdlog::error("websocket write failed: {}", ec.message());
+    m_closed = true;
+    m_timer.cancel();
+  }
+}
+
+bool websocket_session_t::build_frame_message(bool const keyframe_requested,
+                                              uint32_t const sequence,
+                                              bool &is_keyframe) {
+  auto const &frame = m_currentFrame;
+  auto const &previous = m_previousFrame;
+  bool const geometry_changed =
+      frame.width != previous.width || frame.height != previous.height ||
+      frame.stride != previous.stride || frame.bpp != previous.bpp;
+  is_keyframe =
+      keyframe_requested || geometry_changed ||
+      (m_options.keyframe_interval > 0 &&
+       m_framesSinceKeyframe >= m_options.keyframe_interval);
+
+  std::vector<frame_rect_t> rects{};
+  if (is_keyframe) {
+    rects.push_back({0, 0, frame.width, frame.height});
+  } else {
+    rects = find_dirty_tiles(previous, frame, m_options.tile_size);
+    if (rects.empty())
+      return false;
+  }
+
+  auto const now = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+  m_message.clear();
+  details::append_le<uint8_t>(m_message, is_keyframe ? details::KeyFrame
+                                                     : details::DeltaFrame);
+  details::append_le<uint8_t>(m_message, frame.rgb);
+  details::append_le<uint16_t>(m_message, rects.size());
+  details::append_le<uint32_t>(m_message, sequence);
+  details::append_le<uint64_t>(m_message, now.count());
+  details::append_le<uint16_t>(m_message, frame.width);
+  details::append_le<uint16_t>(m_message, frame.height);
+  details::append_le<uint32_t>(m_message, frame.bpp / 8);
+  for (auto const &rect : rects)
+    details::append_compressed_rect(m_message, frame, rect);
+
+  m_framesSinceKeyframe = is_keyframe ? 1 : m_framesSinceKeyframe + 1;
+  return true;
+}
+
+void websocket_session_t::close_stream() {
+  m_closed = true;
+  m_timer.cancel();
+  m_websocket.async_close(
+      websocket::close_code::internal_error,
+      [self = shared_from_this()](beast::error_code const) {});
+}
+} // namespace qadx